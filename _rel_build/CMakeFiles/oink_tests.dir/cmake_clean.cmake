@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/oink_tests.dir/tests/oink.cpp.o"
+  "CMakeFiles/oink_tests.dir/tests/oink.cpp.o.d"
+  "CMakeFiles/oink_tests.dir/tests/tests.cpp.o"
+  "CMakeFiles/oink_tests.dir/tests/tests.cpp.o.d"
+  "oink_tests"
+  "oink_tests.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/oink_tests.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
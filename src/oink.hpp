@@ -3,11 +3,31 @@
 #ifndef oink_hpp
 #define oink_hpp
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <chrono>
+#include <coroutine>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
 #include <map>
+#include <memory>
+#include <numeric>
+#include <mutex>
 #include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
 #include <typeindex>
+#include <unordered_map>
+#include <variant>
+#include <vector>
 
 #include <boost/interprocess/allocators/allocator.hpp>
 #include <boost/interprocess/ipc/message_queue.hpp>
@@ -17,12 +37,155 @@
 
 #include <boost/container/vector.hpp>
 
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 namespace oink {
 namespace bip = boost::interprocess;
 namespace bc = boost::container;
 
-template <typename T>
-using allocator = bip::allocator<T, bip::managed_shared_memory::segment_manager>;
+// Block of arena memory handed out by bumping an offset, for a burst of messages (and their
+// payloads) that are freed around the same time. Nothing in it is freed on its own: the whole
+// block goes back to the arena at once, with the last reference to the region. Lives at the
+// start of its own block.
+struct region {
+  using segment_manager = bip::managed_shared_memory::segment_manager;
+
+  static constexpr std::size_t alignment = alignof(std::max_align_t);
+
+  // Holds the one reference of its creator; throws `bip::bad_alloc` if the arena is full
+  static region *create(segment_manager *segment_manager, std::size_t capacity) {
+    return new (segment_manager->allocate(data_offset() + capacity))
+        region(segment_manager, capacity);
+  }
+
+  region(const region &) = delete;
+  region &operator=(const region &) = delete;
+
+  // Null if there's no room left in the region, or for alignments it doesn't provide
+  void *allocate(std::size_t size, std::size_t align) {
+    if (align > alignment) {
+      return nullptr;
+    }
+    auto used = used_.load(std::memory_order_relaxed);
+    std::size_t start;
+    do {
+      start = (used + align - 1) / align * align;
+      if (start > capacity_ || size > capacity_ - start) {
+        return nullptr;
+      }
+    } while (!used_.compare_exchange_weak(used, start + size, std::memory_order_relaxed));
+    return data() + start;
+  }
+
+  bool contains(const void *p) const {
+    auto c = static_cast<const char *>(p);
+    return c >= data() && c < data() + capacity_;
+  }
+
+  segment_manager *get_segment_manager() const { return segment_manager_.get(); }
+
+  std::size_t capacity() const { return capacity_; }
+  std::size_t used() const { return used_.load(std::memory_order_relaxed); }
+
+  void retain() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Gives the region back to the arena with the last reference
+  void release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      auto segment_manager = segment_manager_.get();
+      std::destroy_at(this);
+      segment_manager->deallocate(this);
+    }
+  }
+
+private:
+  region(segment_manager *segment_manager, std::size_t capacity)
+      : segment_manager_(segment_manager), capacity_(capacity) {}
+
+  static constexpr std::size_t data_offset() {
+    return (sizeof(region) + alignment - 1) / alignment * alignment;
+  }
+
+  char *data() { return reinterpret_cast<char *>(this) + data_offset(); }
+  const char *data() const { return reinterpret_cast<const char *>(this) + data_offset(); }
+
+  bip::offset_ptr<segment_manager> segment_manager_;
+  std::size_t capacity_;
+  std::atomic<std::size_t> used_{0};
+  std::atomic<std::size_t> refs_{1};
+};
+
+// Allocator for objects in the arena. Allocators bound to a `region` take memory from it while
+// there's room and from the arena after that; what came from the region is freed along with
+// it, so objects allocated from it must not outlive the messages sent with it.
+template <typename T> struct allocator {
+  using value_type = T;
+  using pointer = bip::offset_ptr<T>;
+  using const_pointer = bip::offset_ptr<const T>;
+  using void_pointer = bip::offset_ptr<void>;
+  using const_void_pointer = bip::offset_ptr<const void>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using segment_manager = bip::managed_shared_memory::segment_manager;
+
+  template <typename U> struct rebind {
+    using other = allocator<U>;
+  };
+
+  allocator(segment_manager *segment_manager, oink::region *region = nullptr)
+      : segment_manager_(segment_manager), region_(region) {}
+
+  template <typename U>
+  allocator(const allocator<U> &other)
+      : segment_manager_(other.get_segment_manager()), region_(other.region()) {}
+
+  pointer allocate(size_type n) {
+    if (n > max_size()) {
+      throw bip::bad_alloc();
+    }
+    if (region_ != nullptr) {
+      if (auto p = region_->allocate(n * sizeof(T), alignof(T))) {
+        return pointer(static_cast<T *>(p));
+      }
+    }
+    return pointer(static_cast<T *>(segment_manager_->allocate(n * sizeof(T))));
+  }
+
+  void deallocate(const pointer &p, size_type) {
+    if (region_ != nullptr && region_->contains(p.get())) {
+      return;
+    }
+    segment_manager_->deallocate(p.get());
+  }
+
+  size_type max_size() const { return std::numeric_limits<size_type>::max() / sizeof(T); }
+
+  segment_manager *get_segment_manager() const { return segment_manager_.get(); }
+
+  oink::region *region() const { return region_.get(); }
+
+  friend bool operator==(const allocator &a, const allocator &b) {
+    return a.segment_manager_ == b.segment_manager_ && a.region_ == b.region_;
+  }
+
+private:
+  bip::offset_ptr<segment_manager> segment_manager_;
+  bip::offset_ptr<oink::region> region_;
+};
 
 template <typename Container, typename Mutex> struct shared_container {
   using container_type = Container;
@@ -60,11 +223,20 @@ concept arena_constructor = requires(T t, Args &...args) {
   { t(std::forward<Args>(args)...) } -> std::same_as<C *>;
 };
 
+// Process-local state of an `arena` object that outlives it
+struct arena_lifetime {
+  std::mutex mutex;
+  std::atomic<bool> alive = true;
+  // Flushes threads' cached memory back into the arena, by cache
+  std::unordered_map<const void *, std::function<void()>> caches;
+};
+
 struct arena {
 
   friend struct endpoint;
   friend struct sender;
   friend struct receiver;
+  friend struct magazine_cache;
   template <message M> friend struct message_envelope_receipt;
 
   struct header {
@@ -81,11 +253,23 @@ struct arena {
       : name(segment_name), segment(bip::open_or_create, segment_name, segment_size),
         header_(segment.find_or_construct<header_t>("__header")()) {}
 
+  // Threads still using the arena at this point lose what they cache of it
+  ~arena() {
+    std::lock_guard lock(lifetime_->mutex);
+    for (auto &[_, flush] : lifetime_->caches) {
+      flush();
+    }
+    lifetime_->caches.clear();
+    lifetime_->alive = false;
+  }
+
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+
   auto get_segment_manager() { return segment.get_segment_manager(); }
 
-  template <typename T> auto get_allocator() {
-    return bip::allocator<T, bip::managed_shared_memory::segment_manager>(
-        segment.get_segment_manager());
+  template <typename T> allocator<T> get_allocator() {
+    return allocator<T>(segment.get_segment_manager());
   }
 
   void *get_address() { return segment.get_address(); }
@@ -114,6 +298,9 @@ protected:
   bip::managed_shared_memory segment;
 
   header_t *header_;
+
+private:
+  std::shared_ptr<arena_lifetime> lifetime_ = std::make_shared<arena_lifetime>();
 };
 
 struct transient_arena : arena {
@@ -129,213 +316,4445 @@ private:
   bip::remove_shared_memory_on_destroy removal_;
 };
 
-struct endpoint {
+// Size used to keep independently written atomics off each other's cache lines
+inline constexpr std::size_t cache_line_size = 64;
 
-  struct msg {
-    std::size_t hash;
-    std::ptrdiff_t offset;
-  };
+// Pads `T` to occupy at least a full cache line. We don't rely on `alignas` here as
+// allocations in the shared memory segment don't honor over-alignment.
+template <typename T> struct cache_padded {
+  T value{};
 
-  endpoint(arena &arena, const char *mq_segment_name, size_t mq_max_messages)
-      : arena_(arena), mq_(bip::open_or_create, mq_segment_name, mq_max_messages, sizeof(msg)),
-        msgs_(arena.get_segment_manager()->find_or_construct<msg_vec>("__msgs")(
-            arena.get_segment_manager())) {}
+private:
+  [[maybe_unused]] char padding_[cache_line_size - sizeof(T) % cache_line_size];
+};
 
-  template <typename T> auto get_allocator() { return arena_.get_allocator<T>(); }
+// Hints the CPU that we're in a spin loop
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
 
-  template <typename T> T &get_msg(std::ptrdiff_t index) {
-    void *addr = static_cast<char *>(arena_.segment.get_address()) + index;
-    return reinterpret_cast<T &>(addr);
+// Wait/notify primitive that can be placed in shared memory.
+//
+// Waiters register themselves and park on `epoch_` (a futex word on Linux). Notifying is a
+// fence and a load of `waiters_` unless someone is actually parked, so publishers don't pay
+// for a syscall (or even a read-modify-write) when nobody waits.
+struct notifier {
+  using clock = std::chrono::steady_clock;
+
+  // Calls `ready` until it returns `true`, parking between attempts. Returns `false` if the
+  // deadline passed without `ready` succeeding.
+  template <typename Ready> bool wait_until(Ready &&ready, clock::time_point deadline) {
+    for (;;) {
+      if (ready()) {
+        return true;
+      }
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+      std::uint32_t epoch = epoch_.load(std::memory_order_seq_cst);
+      // Re-check after registering: a notification that came before we registered could
+      // have skipped the wakeup
+      if (ready()) {
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+      bool timed_out = !park(epoch, deadline);
+      waiters_.fetch_sub(1, std::memory_order_relaxed);
+      if (timed_out) {
+        return ready();
+      }
+    }
   }
 
-protected:
-  using msg_allocator_t = allocator<msg>;
-  using msg_vec =
-      shared_container<bc::vector<msg, msg_allocator_t>, bip::interprocess_recursive_mutex>;
+  // Must be called after the state `ready` checks for has been published
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch_), FUTEX_WAKE, INT_MAX, nullptr,
+            nullptr, 0);
+#endif
+  }
 
-  arena &arena_;
-  bip::message_queue mq_;
+private:
+  static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t) &&
+                    std::atomic<std::uint32_t>::is_always_lock_free,
+                "futex word must be a plain 32-bit integer");
 
-  msg_vec *msgs_;
+  // Returns `false` once the deadline has passed, `true` on (possibly spurious) wakeup
+  bool park(std::uint32_t epoch, clock::time_point deadline) {
+    auto now = clock::now();
+    if (now >= deadline) {
+      return false;
+    }
+#if defined(__linux__)
+    // Futex timeouts are relative and measured against CLOCK_MONOTONIC, same as `steady_clock`.
+    // The word is in shared memory, so this can't be a `FUTEX_PRIVATE_FLAG` futex.
+    timespec timeout{};
+    timespec *timeout_ptr = nullptr;
+    if (deadline != clock::time_point::max()) {
+      auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now);
+      timeout.tv_sec = static_cast<time_t>(remaining.count() / 1'000'000'000);
+      timeout.tv_nsec = static_cast<long>(remaining.count() % 1'000'000'000);
+      timeout_ptr = &timeout;
+    }
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch_), FUTEX_WAIT, epoch, timeout_ptr,
+            nullptr, 0);
+#else
+    // No portable cross-process address wait elsewhere; back off with short sleeps
+    if (epoch_.load(std::memory_order_acquire) == epoch) {
+      std::this_thread::sleep_for(
+          std::min<clock::duration>(deadline - now, std::chrono::microseconds(200)));
+    }
+#endif
+    return true;
+  }
+
+  std::atomic<std::uint32_t> epoch_{0};
+  std::atomic<std::uint32_t> waiters_{0};
 };
 
-template <message M> struct message_envelope {
-  template <typename... Args>
-  message_envelope(Args &&...args) : message(std::forward<Args>(args)...), counter(0) {}
+// Notifiers of whoever watches an endpoint besides its own receivers and senders (such as an
+// `executor`), kept in the arena by offset. Notifying costs a single load while nobody
+// watches.
+struct watch_list {
+  static constexpr std::size_t max_watchers = 16;
 
-  operator M &() { return message; }
+  // Returns `false` if all slots are taken
+  bool add(arena &arena, notifier &watcher) {
+    auto offset = offset_of(arena, watcher);
+    for (auto &slot : slots_) {
+      std::ptrdiff_t empty = 0;
+      if (slot.compare_exchange_strong(empty, offset, std::memory_order_seq_cst)) {
+        count_.fetch_add(1, std::memory_order_seq_cst);
+        return true;
+      }
+    }
+    return false;
+  }
 
-  template <message M_> friend struct message_envelope_receipt;
+  void remove(arena &arena, notifier &watcher) {
+    auto offset = offset_of(arena, watcher);
+    for (auto &slot : slots_) {
+      auto expected = offset;
+      if (slot.compare_exchange_strong(expected, 0, std::memory_order_seq_cst)) {
+        count_.fetch_sub(1, std::memory_order_seq_cst);
+        return;
+      }
+    }
+  }
+
+  // Must be called after the state watchers check for has been published
+  void notify(arena &arena) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (count_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    for (auto &slot : slots_) {
+      if (auto offset = slot.load(std::memory_order_acquire); offset != 0) {
+        reinterpret_cast<notifier *>(static_cast<char *>(arena.get_address()) + offset)->notify();
+      }
+    }
+  }
 
 private:
-  M message;
-  std::atomic<std::size_t> counter;
-};
+  static std::ptrdiff_t offset_of(arena &arena, notifier &watcher) {
+    return reinterpret_cast<char *>(&watcher) - static_cast<char *>(arena.get_address());
+  }
 
-template <message M> struct message_envelope_receipt {
+  std::atomic<std::size_t> count_{0};
+  std::atomic<std::ptrdiff_t> slots_[max_watchers]{};
+};
 
-  M *operator->() { return &envelope->message; }
+// Owned file descriptor
+struct file_descriptor {
+  file_descriptor() = default;
+  explicit file_descriptor(int fd) : fd_(fd) {}
 
-  operator M &() { return envelope->message; }
+  file_descriptor(file_descriptor &&other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
 
-  ~message_envelope_receipt() {
-    if (envelope != nullptr) {
-      std::size_t counter = envelope->counter.fetch_sub(1) - 1;
-      if (counter == 0) {
-        std::destroy_at(envelope);
-        arena_.get().template get_allocator<message_envelope<M>>().deallocate(envelope, 1);
-      }
+  file_descriptor &operator=(file_descriptor &&other) noexcept {
+    if (this != &other) {
+      reset();
+      fd_ = std::exchange(other.fd_, -1);
     }
+    return *this;
   }
 
-  friend struct sender;
-  friend struct receiver;
+  ~file_descriptor() { reset(); }
 
-  message_envelope_receipt(const message_envelope_receipt &other)
-      : envelope(other.envelope), arena_(other.arena_) {
-    other.envelope->counter.fetch_add(1);
+  int get() const { return fd_; }
+
+  explicit operator bool() const { return fd_ >= 0; }
+
+private:
+  void reset() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
   }
 
-  message_envelope_receipt(message_envelope_receipt &&other) noexcept
-      : envelope(other.envelope), arena_(other.arena_) {
-    other.envelope = nullptr;
+  int fd_ = -1;
+};
+
+// Pollable file descriptor that can be signalled from any process: a non-blocking Unix
+// datagram socket bound to a path of its own in the temporary directory. Signalling it is
+// addressed by that path, so a handle whose owner is gone can't be mistaken for another
+// process's descriptor; sending to it just fails.
+struct event_handle {
+  using path_type = std::array<char, sizeof(sockaddr_un::sun_path)>;
+
+  event_handle() {
+    socket_ = file_descriptor(::socket(AF_UNIX, SOCK_DGRAM, 0));
+    if (!socket_) {
+      throw std::system_error(errno, std::generic_category(), "socket");
+    }
+    ::fcntl(socket_.get(), F_SETFL, ::fcntl(socket_.get(), F_GETFL) | O_NONBLOCK);
+    ::fcntl(socket_.get(), F_SETFD, FD_CLOEXEC);
+
+    static std::atomic<std::uint64_t> counter{0};
+    auto dir = std::getenv("TMPDIR");
+    auto prefix = std::string(dir != nullptr && *dir != '\0' ? dir : "/tmp") + "/oink-" +
+                  std::to_string(::getpid()) + "-";
+    for (int attempt = 0;; attempt++) {
+      auto path = prefix + std::to_string(counter.fetch_add(1));
+      if (path.size() >= path_.size()) {
+        throw std::length_error("event handle path too long: " + path);
+      }
+      path_type candidate{};
+      std::ranges::copy(path, candidate.begin());
+      // Processes in other pid namespaces sharing the directory may have the same pid, so a
+      // path is only taken over if it's left over by one that is gone
+      if (alive(candidate)) {
+        if (attempt == max_attempts) {
+          throw std::system_error(EADDRINUSE, std::generic_category(), "bind " + path);
+        }
+        continue;
+      }
+      ::unlink(candidate.data());
+      auto address = address_of(candidate);
+      if (::bind(socket_.get(), reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0) {
+        path_ = candidate;
+        break;
+      }
+      if (errno != EADDRINUSE || attempt == max_attempts) {
+        throw std::system_error(errno, std::generic_category(), "bind " + path);
+      }
+    }
   }
 
-  message_envelope_receipt &operator=(const message_envelope_receipt &other) {
-    if (this == &other)
-      return *this;
-    envelope = other.envelope;
-    arena_ = other.arena_;
-    other.envelope->counter.fetch_add(1);
-    return *this;
+  event_handle(const event_handle &) = delete;
+  event_handle &operator=(const event_handle &) = delete;
+
+  ~event_handle() { ::unlink(path_.data()); }
+
+  // Becomes readable once signalled
+  int native_handle() const { return socket_.get(); }
+
+  // What `signal()` is given to reach the handle
+  const path_type &path() const { return path_; }
+
+  // Makes the handle unreadable again
+  void reset() {
+    char buffer[64];
+    while (::recv(socket_.get(), buffer, sizeof(buffer), 0) > 0) {
+    }
   }
 
-  message_envelope_receipt &operator=(message_envelope_receipt &&other) noexcept {
-    if (this == &other)
-      return *this;
-    envelope = other.envelope;
-    arena_ = other.arena_;
-    other.envelope = nullptr;
-    return *this;
+  // Whether something is still bound to `path`, without signalling it
+  static bool alive(const path_type &path) {
+    auto address = address_of(path);
+    file_descriptor probe(::socket(AF_UNIX, SOCK_DGRAM, 0));
+    return !probe ||
+           ::connect(probe.get(), reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0 ||
+           (errno != ECONNREFUSED && errno != ENOENT);
   }
 
-private:
-  message_envelope_receipt(message_envelope<M> *envelope, arena &arena, bool acquire = true)
-      : envelope(envelope), arena_(arena) {
-    if (acquire) {
-      envelope->counter.fetch_add(2);
+  // Returns `false` if nothing is bound to `path` any more, i.e. the handle's owner is gone.
+  // If the handle can't be reached for any other reason, `error` is set.
+  static bool signal(const path_type &path, std::error_code &error) {
+    auto address = address_of(path);
+    char one = 1;
+    int flags = MSG_DONTWAIT;
+#if defined(MSG_NOSIGNAL)
+    flags |= MSG_NOSIGNAL;
+#endif
+    if (::sendto(sending_socket(), &one, sizeof(one), flags,
+                 reinterpret_cast<sockaddr *>(&address), sizeof(address)) >= 0) {
+      return true;
+    }
+    switch (errno) {
+    // A full socket is readable already
+    case EAGAIN:
+    case ENOBUFS:
+      return true;
+    case ECONNREFUSED:
+    case ENOENT:
+      return false;
+    default:
+      error = std::error_code(errno, std::generic_category());
+      return true;
     }
   }
 
-  std::ptrdiff_t offset() {
-    return reinterpret_cast<char *>(envelope) -
-           reinterpret_cast<char *>(arena_.get().get_address());
+private:
+  // Paths in use tried before giving up
+  static constexpr int max_attempts = 16;
+
+  static sockaddr_un address_of(const path_type &path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::ranges::copy(path, address.sun_path);
+    return address;
   }
 
-  void retain() { envelope = nullptr; }
+  // Unbound socket the process signals handles with
+  static int sending_socket() {
+    static file_descriptor socket = [] {
+      file_descriptor socket(::socket(AF_UNIX, SOCK_DGRAM, 0));
+      if (!socket) {
+        throw std::system_error(errno, std::generic_category(), "socket");
+      }
+      ::fcntl(socket.get(), F_SETFD, FD_CLOEXEC);
+      return socket;
+    }();
+    return socket.get();
+  }
 
-  message_envelope<M> *envelope;
-  std::reference_wrapper<arena> arena_;
+  file_descriptor socket_;
+  path_type path_{};
 };
 
-struct sender : endpoint {
-  using endpoint::endpoint;
+// Event handles of the receivers polling an endpoint, kept in the arena. A handle is armed
+// while its receiver has found the endpoint empty and is signalled by the first sender that
+// queues something after that, so a burst of sends costs one write.
+struct poll_list {
+  static constexpr std::size_t max_pollers = 16;
 
-  template <message M, typename... Args> message_envelope_receipt<M> send(Args &&...args) {
-    auto msg_ = arena_.get_allocator<message_envelope<M>>().allocate(1);
-    std::construct_at(msg_.get(), std::forward<Args>(args)...);
-    message_envelope_receipt<M> receipt = message_envelope_receipt(msg_.get(), arena_);
-    auto m = msg{.hash = message_tag<M>(), .offset = receipt.offset()};
-    mq_.send(&m, sizeof(decltype(m)), 0);
-    return receipt;
+  struct slot {
+    // Unique for every registration, zero while the slot is free
+    std::atomic<std::uint64_t> id{0};
+    event_handle::path_type path{};
+    std::atomic<bool> armed{false};
+  };
+
+  // Returns `nullptr` if all slots are taken by live receivers
+  slot *add(const event_handle::path_type &path) {
+    auto id = next_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+    for (bool reclaimed = false;; reclaimed = true) {
+      for (auto &slot : slots_) {
+        std::uint64_t free = 0;
+        if (slot.id.compare_exchange_strong(free, id, std::memory_order_acquire)) {
+          slot.path = path;
+          slot.armed.store(false, std::memory_order_relaxed);
+          count_.fetch_add(1, std::memory_order_seq_cst);
+          return &slot;
+        }
+      }
+      if (reclaimed) {
+        return nullptr;
+      }
+      // Frees the slots of receivers whose process died
+      for (auto &slot : slots_) {
+        auto owner = slot.id.load(std::memory_order_acquire);
+        if (owner != 0 && !event_handle::alive(slot.path)) {
+          remove(slot, owner);
+        }
+      }
+    }
+  }
+
+  // Frees the slot if it still holds registration `id`
+  void remove(slot &slot, std::uint64_t id) {
+    slot.armed.store(false, std::memory_order_relaxed);
+    if (slot.id.compare_exchange_strong(id, 0, std::memory_order_release)) {
+      count_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+  }
+
+  // Disarms and signals every armed slot. Must be called after the queued entries have been
+  // published. Slots of receivers that are gone without removing them (because their process
+  // died) are freed. Handles that can't be signalled stay armed, and `error` is set.
+  void notify(std::error_code &error) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (count_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    for (auto &slot : slots_) {
+      if (slot.armed.load(std::memory_order_relaxed) && slot.armed.exchange(false)) {
+        auto id = slot.id.load(std::memory_order_acquire);
+        std::error_code failed;
+        if (id != 0 && !event_handle::signal(slot.path, failed)) {
+          remove(slot, id);
+        } else if (failed) {
+          slot.armed.store(true, std::memory_order_relaxed);
+          error = failed;
+        }
+      }
+    }
   }
+
+private:
+  std::atomic<std::size_t> count_{0};
+  std::atomic<std::uint64_t> next_id_{0};
+  slot slots_[max_pollers];
 };
 
-struct receiver : endpoint {
-  using endpoint::endpoint;
+// Operation a suspended coroutine waits for. Its `executor` attempts it again whenever the
+// endpoint it watches signals.
+struct pending_operation {
+  // Returns `true` once the operation is done
+  virtual bool try_complete() = 0;
+  // When to attempt the operation again even if nothing signals
+  virtual std::chrono::steady_clock::time_point retry_at() {
+    return std::chrono::steady_clock::time_point::max();
+  }
 
-  struct unknown_message : public std::exception {
-    explicit unknown_message(std::size_t hash)
-        : hash(hash), message(std::string("unknown message ") + std::to_string(hash)) {}
+protected:
+  ~pending_operation() = default;
+};
 
-    const char *what() const noexcept override { return message.c_str(); }
+// Bounded single-producer/single-consumer ring living in the arena.
+//
+// Producer and consumer each own a cache line with their index and a cached copy of the
+// other side's index, so the fast path touches no shared cache lines unless the ring appears
+// to be full (or empty).
+template <typename T> struct spsc_ring {
+  static_assert(std::is_trivially_copyable_v<T>, "ring slots are copied as raw memory");
 
-    std::size_t message_hash() const { return hash; }
+  using value_type = T;
 
-  private:
-    std::size_t hash;
-    std::string message;
-  };
+  spsc_ring(std::size_t capacity, const allocator<T> &alloc)
+      : capacity_(std::bit_ceil(std::max<std::size_t>(capacity, 1))), alloc_(alloc),
+        slots_(alloc_.allocate(capacity_)) {}
 
-  template <message... Msg> bool receive(auto visitor) {
-    bip::message_queue::size_type recvd_size;
-    unsigned int priority;
+  ~spsc_ring() { alloc_.deallocate(slots_, capacity_); }
 
-    msg m;
-    if (mq_.timed_receive(&m, sizeof(m), recvd_size, priority,
-                          std::chrono::system_clock::now() + std::chrono::milliseconds(500))) {
-
-      bool matched = false;
-      bool accepted = true;
-
-      (try_handle<Msg>(m, matched, accepted, visitor), ...);
-
-      if (!matched) {
-        if constexpr (requires(decltype(visitor) v, msg &index) {
-                        { v(index) };
-                      }) {
-          using return_type = std::invoke_result_t<decltype(visitor), msg &>;
-          if constexpr (std::same_as<return_type, bool>) {
-            accepted = visitor(m);
-          } else {
-            visitor(m);
-          }
-          matched = true;
-        }
-      }
+  spsc_ring(const spsc_ring &) = delete;
+  spsc_ring &operator=(const spsc_ring &) = delete;
 
-      if (!accepted) {
-        mq_.send(&m, sizeof(m), 0);
+  bool try_push(const T &item) {
+    auto &p = producer_.value;
+    std::size_t tail = p.tail.load(std::memory_order_relaxed);
+    if (tail - p.head_cache == capacity_) {
+      p.head_cache = consumer_.value.head.load(std::memory_order_acquire);
+      if (tail - p.head_cache == capacity_) {
         return false;
       }
-      if (!matched) {
-        throw unknown_message(m.hash);
-      }
-
-      if (mq_.get_num_msg() == 0) {
-        auto [lock, container] = msgs_->scoped_lock();
-        container.clear();
-      }
+    }
+    slots_[tail & (capacity_ - 1)] = item;
+    p.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
 
-      return true;
-    } else {
-      return false;
+  // Pushes as many of `items` as fit with a single tail update, returns how many were pushed
+  std::size_t try_push_many(const T *items, std::size_t count) {
+    auto &p = producer_.value;
+    std::size_t tail = p.tail.load(std::memory_order_relaxed);
+    if (capacity_ - (tail - p.head_cache) < count) {
+      p.head_cache = consumer_.value.head.load(std::memory_order_acquire);
     }
+    count = std::min(count, capacity_ - (tail - p.head_cache));
+    for (std::size_t i = 0; i < count; i++) {
+      slots_[(tail + i) & (capacity_ - 1)] = items[i];
+    }
+    if (count > 0) {
+      p.tail.store(tail + count, std::memory_order_release);
+    }
+    return count;
   }
 
-private:
-  template <message T> void try_handle(msg &j, bool &matched, bool &accepted, auto visitor) {
-    if (j.hash == message_tag<T>()) {
-      if constexpr (requires(decltype(visitor) v, T &index) {
-                      { v(index) };
-                    }) {
-        using return_type = std::invoke_result_t<decltype(visitor), T &>;
-        message_envelope_receipt<T> p(
-            reinterpret_cast<message_envelope<T> *>(
-                static_cast<char *>(arena_.segment.get_address()) + j.offset),
-            arena_, false);
-        if constexpr (std::same_as<return_type, bool>) {
-          accepted = visitor(p.operator T &());
-        } else {
-          visitor(p.operator T &());
-        }
-        matched = true;
-        if (!accepted) {
-          p.retain();
-        }
+  bool try_pop(T &item) {
+    auto &c = consumer_.value;
+    std::size_t head = c.head.load(std::memory_order_relaxed);
+    if (head == c.tail_cache) {
+      c.tail_cache = producer_.value.tail.load(std::memory_order_acquire);
+      if (head == c.tail_cache) {
+        return false;
       }
     }
+    item = slots_[head & (capacity_ - 1)];
+    c.head.store(head + 1, std::memory_order_release);
+    return true;
   }
+
+  // Pops up to `max` items with a single head update, returns how many were popped
+  std::size_t try_pop_many(T *items, std::size_t max) {
+    auto &c = consumer_.value;
+    std::size_t head = c.head.load(std::memory_order_relaxed);
+    if (c.tail_cache - head < max) {
+      c.tail_cache = producer_.value.tail.load(std::memory_order_acquire);
+    }
+    std::size_t count = std::min(max, c.tail_cache - head);
+    for (std::size_t i = 0; i < count; i++) {
+      items[i] = slots_[(head + i) & (capacity_ - 1)];
+    }
+    if (count > 0) {
+      c.head.store(head + count, std::memory_order_release);
+    }
+    return count;
+  }
+
+  std::size_t size() const {
+    std::size_t head = consumer_.value.head.load(std::memory_order_acquire);
+    return producer_.value.tail.load(std::memory_order_acquire) - head;
+  }
+
+  std::size_t capacity() const { return capacity_; }
+
+private:
+  struct producer_side {
+    std::atomic<std::size_t> tail{0};
+    std::size_t head_cache = 0;
+  };
+
+  struct consumer_side {
+    std::atomic<std::size_t> head{0};
+    std::size_t tail_cache = 0;
+  };
+
+  cache_padded<producer_side> producer_;
+  cache_padded<consumer_side> consumer_;
+
+  std::size_t capacity_;
+  allocator<T> alloc_;
+  bip::offset_ptr<T> slots_;
+};
+
+// Bounded multi-producer ring living in the arena.
+//
+// Every slot carries a sequence number telling whose turn it is (D. Vyukov's bounded queue):
+// producers claim a position with a CAS on the tail and publish the slot by bumping its
+// sequence. With `MultiConsumer`, consumers claim positions the same way on the head;
+// otherwise the only consumer reads slots in order without any read-modify-write.
+template <typename T, bool MultiConsumer> struct sequenced_ring {
+  static_assert(std::is_trivially_copyable_v<T>, "ring slots are copied as raw memory");
+
+  using value_type = T;
+
+  // A ring needs at least two slots: with one, a slot's "consumed" sequence (`pos +
+  // capacity`) would be the same as its "published" one (`pos + 1`)
+  sequenced_ring(std::size_t capacity, const allocator<T> &alloc)
+      : capacity_(std::bit_ceil(std::max<std::size_t>(capacity, 2))), alloc_(alloc),
+        slots_(alloc_.allocate(capacity_)) {
+    for (std::size_t i = 0; i < capacity_; i++) {
+      std::construct_at(&slots_[i], i);
+    }
+  }
+
+  ~sequenced_ring() { alloc_.deallocate(slots_, capacity_); }
+
+  sequenced_ring(const sequenced_ring &) = delete;
+  sequenced_ring &operator=(const sequenced_ring &) = delete;
+
+  bool try_push(const T &item) {
+    std::size_t pos = tail_.value.load(std::memory_order_relaxed);
+    slot *s;
+    for (;;) {
+      s = &slots_[pos & (capacity_ - 1)];
+      std::size_t seq = s->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (tail_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // The slot still holds an item from the previous lap: we're full
+        return false;
+      } else {
+        pos = tail_.value.load(std::memory_order_relaxed);
+      }
+    }
+    s->value = item;
+    s->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Claims a run of free positions with a single CAS on the tail and fills them, returns how
+  // many of `items` were pushed
+  std::size_t try_push_many(const T *items, std::size_t count) {
+    std::size_t pos = tail_.value.load(std::memory_order_relaxed);
+    std::size_t claimed;
+    for (;;) {
+      claimed = 0;
+      bool stale = false;
+      while (claimed < count) {
+        std::size_t seq =
+            slots_[(pos + claimed) & (capacity_ - 1)].sequence.load(std::memory_order_acquire);
+        auto diff =
+            static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + claimed);
+        if (diff != 0) {
+          // Either full from here on or somebody else claimed `pos` already
+          stale = diff > 0;
+          break;
+        }
+        claimed++;
+      }
+      if (claimed == 0 && !stale) {
+        return 0;
+      }
+      if (claimed > 0 &&
+          tail_.value.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed)) {
+        break;
+      }
+      if (claimed == 0) {
+        pos = tail_.value.load(std::memory_order_relaxed);
+      }
+    }
+    for (std::size_t i = 0; i < claimed; i++) {
+      slot &s = slots_[(pos + i) & (capacity_ - 1)];
+      s.value = items[i];
+      s.sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return claimed;
+  }
+
+  bool try_pop(T &item) {
+    std::size_t pos = head_.value.load(std::memory_order_relaxed);
+    if constexpr (MultiConsumer) {
+      slot *s;
+      for (;;) {
+        s = &slots_[pos & (capacity_ - 1)];
+        std::size_t seq = s->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+        if (diff == 0) {
+          if (head_.value.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        } else if (diff < 0) {
+          // Nothing has been published at this position yet: we're empty
+          return false;
+        } else {
+          pos = head_.value.load(std::memory_order_relaxed);
+        }
+      }
+      item = s->value;
+      s->sequence.store(pos + capacity_, std::memory_order_release);
+    } else {
+      slot &s = slots_[pos & (capacity_ - 1)];
+      if (s.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+      }
+      item = s.value;
+      s.sequence.store(pos + capacity_, std::memory_order_release);
+      head_.value.store(pos + 1, std::memory_order_release);
+    }
+    return true;
+  }
+
+  // Takes a run of published items with a single head update (a single CAS with
+  // `MultiConsumer`), returns how many were popped
+  std::size_t try_pop_many(T *items, std::size_t max) {
+    std::size_t pos = head_.value.load(std::memory_order_relaxed);
+    std::size_t count;
+    for (;;) {
+      count = 0;
+      bool stale = false;
+      while (count < max) {
+        std::size_t seq =
+            slots_[(pos + count) & (capacity_ - 1)].sequence.load(std::memory_order_acquire);
+        auto diff =
+            static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + count + 1);
+        if (diff != 0) {
+          // Either nothing is published from here on or another consumer took `pos` already
+          stale = diff > 0;
+          break;
+        }
+        count++;
+      }
+      if constexpr (!MultiConsumer) {
+        break;
+      } else {
+        if (count == 0 && !stale) {
+          break;
+        }
+        if (count > 0 &&
+            head_.value.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+          break;
+        }
+        if (count == 0) {
+          pos = head_.value.load(std::memory_order_relaxed);
+        }
+      }
+    }
+    for (std::size_t i = 0; i < count; i++) {
+      slot &s = slots_[(pos + i) & (capacity_ - 1)];
+      items[i] = s.value;
+      s.sequence.store(pos + i + capacity_, std::memory_order_release);
+    }
+    if constexpr (!MultiConsumer) {
+      if (count > 0) {
+        head_.value.store(pos + count, std::memory_order_release);
+      }
+    }
+    return count;
+  }
+
+  std::size_t size() const {
+    std::size_t head = head_.value.load(std::memory_order_acquire);
+    std::size_t tail = tail_.value.load(std::memory_order_acquire);
+    // Tail counts claimed positions, some of which may be still being written
+    return tail > head ? tail - head : 0;
+  }
+
+  std::size_t capacity() const { return capacity_; }
+
+private:
+  struct slot {
+    explicit slot(std::size_t seq) : sequence(seq) {}
+
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  cache_padded<std::atomic<std::size_t>> tail_;
+  cache_padded<std::atomic<std::size_t>> head_;
+
+  std::size_t capacity_;
+  allocator<slot> alloc_;
+  bip::offset_ptr<slot> slots_;
+};
+
+template <typename T> using mpsc_ring = sequenced_ring<T, false>;
+template <typename T> using mpmc_ring = sequenced_ring<T, true>;
+
+// Selects what carries `endpoint::msg` entries between senders and receivers
+enum class transport_kind {
+  // `bip::message_queue`, a separate shared memory object guarded by a mutex
+  // and a condition variable
+  message_queue,
+  // `spsc_ring` in the arena; only valid with one sender and one receiver
+  spsc_ring,
+  // `mpsc_ring` in the arena; any number of senders, one receiver
+  mpsc_ring,
+  // `mpmc_ring` in the arena; any number of senders and receivers
+  mpmc_ring,
+};
+
+// Process-local handle to the queue an endpoint is attached to.
+//
+// Items are pushed with a priority and higher priorities are popped first.
+template <typename T> struct transport {
+  using clock = std::chrono::steady_clock;
+
+  virtual ~transport() = default;
+
+  // Blocks until there's room for the item
+  virtual void push(const T &item, unsigned int priority) = 0;
+  // Returns `false` if there's no room for the item
+  virtual bool try_push(const T &item, unsigned int priority) = 0;
+  // Returns `false` if there was no room for the item by the deadline
+  virtual bool push_until(const T &item, unsigned int priority, clock::time_point deadline) = 0;
+  // Blocks until all items are pushed. Transports that can publish a run of items at once
+  // (and wake receivers once) override this.
+  virtual void push_many(const T *items, std::size_t count, unsigned int priority) {
+    for (std::size_t i = 0; i < count; i++) {
+      push(items[i], priority);
+    }
+  }
+  virtual bool try_pop(T &item) = 0;
+  virtual bool pop_until(T &item, clock::time_point deadline) = 0;
+  // Pops up to `max` items, returns how many were popped
+  virtual std::size_t try_pop_many(T *items, std::size_t max) {
+    std::size_t count = 0;
+    while (count < max && try_pop(items[count])) {
+      count++;
+    }
+    return count;
+  }
+  // Waits for at least one item and pops up to `max`, returns how many were popped
+  virtual std::size_t pop_many_until(T *items, std::size_t max, clock::time_point deadline) {
+    if (max == 0 || !pop_until(items[0], deadline)) {
+      return 0;
+    }
+    return 1 + try_pop_many(items + 1, max - 1);
+  }
+  virtual std::size_t size() = 0;
+  // May be briefly out of date but never takes a lock
+  virtual bool empty() = 0;
+  // Makes pops that are waiting right now return, empty-handed if need be, without queueing
+  // anything
+  virtual void wake() = 0;
+};
+
+// `bip::message_queue` orders entries by priority itself, so there are no separate lanes
+//
+// Its own message count can only be read under its mutex, so we keep a count of pending
+// entries next to it in the arena for lock-free emptiness checks. Receivers park on a
+// notifier kept there as well rather than on the queue's condition variable, which nothing
+// but a message could wake them up from.
+template <typename T> struct message_queue_transport : transport<T> {
+  using typename transport<T>::clock;
+
+  message_queue_transport(arena &arena, const char *name, std::size_t max_messages)
+      : mq_(bip::open_or_create, name, max_messages, sizeof(T)),
+        state_(arena.get_segment_manager()->find_or_construct<state>(
+            (std::string(name) + ".state").c_str())()) {}
+
+  void push(const T &item, unsigned int priority) override {
+    mq_.send(&item, sizeof(T), priority);
+    pushed();
+  }
+
+  bool try_push(const T &item, unsigned int priority) override {
+    return mq_.try_send(&item, sizeof(T), priority) && pushed();
+  }
+
+  bool push_until(const T &item, unsigned int priority, clock::time_point deadline) override {
+    if (deadline == clock::time_point::max()) {
+      push(item, priority);
+      return true;
+    }
+    return mq_.timed_send(&item, sizeof(T), priority, to_ptime(deadline)) && pushed();
+  }
+
+  bool try_pop(T &item) override {
+    bip::message_queue::size_type recvd_size;
+    unsigned int priority;
+    return mq_.try_receive(&item, sizeof(T), recvd_size, priority) && popped();
+  }
+
+  bool pop_until(T &item, clock::time_point deadline) override {
+    auto wakeups = state_->wakeups.load(std::memory_order_acquire);
+    bool popped = false;
+    state_->readable.value.wait_until(
+        [&] {
+          return (popped = try_pop(item)) ||
+                 state_->wakeups.load(std::memory_order_acquire) != wakeups;
+        },
+        deadline);
+    return popped;
+  }
+
+  std::size_t size() override { return mq_.get_num_msg(); }
+
+  // The count is updated after the fact, so it may go negative for a moment
+  bool empty() override { return state_->pending.load(std::memory_order_acquire) <= 0; }
+
+  void wake() override {
+    state_->wakeups.fetch_add(1, std::memory_order_release);
+    state_->readable.value.notify();
+  }
+
+private:
+  // What lives in the arena under `<name>.state`
+  struct state {
+    std::atomic<std::ptrdiff_t> pending{0};
+    // Bumped by `wake()`
+    std::atomic<std::uint32_t> wakeups{0};
+    // Signalled when an item was pushed
+    cache_padded<notifier> readable;
+  };
+
+  bool pushed() {
+    state_->pending.fetch_add(1, std::memory_order_release);
+    state_->readable.value.notify();
+    return true;
+  }
+
+  bool popped() {
+    state_->pending.fetch_sub(1, std::memory_order_release);
+    return true;
+  }
+
+  // `bip::message_queue` takes an absolute (UTC) `ptime`, so we translate our monotonic
+  // deadlines into one
+  static boost::posix_time::ptime to_ptime(clock::time_point deadline) {
+    auto remaining =
+        std::chrono::duration_cast<std::chrono::microseconds>(deadline - clock::now());
+    return boost::posix_time::microsec_clock::universal_time() +
+           boost::posix_time::microseconds(remaining.count());
+  }
+
+  bip::message_queue mq_;
+  state *state_;
+};
+
+// Keeps one ring (lane) per priority level, so high priority entries never queue up behind
+// low priority ones. Lanes share notifiers, which lets a receiver park on all of them at once.
+template <typename Ring> struct ring_transport : transport<typename Ring::value_type> {
+  using T = typename Ring::value_type;
+  using typename transport<T>::clock;
+
+  ring_transport(arena &arena, const char *name, std::size_t capacity, std::size_t lanes)
+      : state_(arena.get_segment_manager()->find_or_construct<state>(name)(
+            capacity, std::max<std::size_t>(lanes, 1), arena.get_allocator<T>())) {}
+
+  // Frees the rings of the endpoint named `name`; nobody may use them any more
+  static void destroy(arena &arena, const char *name) {
+    arena.get_segment_manager()->destroy<state>(name);
+  }
+
+  void push(const T &item, unsigned int priority) override {
+    push_until(item, priority, clock::time_point::max());
+  }
+
+  bool try_push(const T &item, unsigned int priority) override {
+    if (lane(priority).try_push(item)) {
+      state_->readable.value.notify();
+      return true;
+    }
+    return false;
+  }
+
+  bool push_until(const T &item, unsigned int priority, clock::time_point deadline) override {
+    Ring &ring = lane(priority);
+    if (state_->writable.value.wait_until([&] { return ring.try_push(item); }, deadline)) {
+      state_->readable.value.notify();
+      return true;
+    }
+    return false;
+  }
+
+  void push_many(const T *items, std::size_t count, unsigned int priority) override {
+    Ring &ring = lane(priority);
+    std::size_t pushed = 0;
+    while (pushed < count) {
+      std::size_t n = 0;
+      state_->writable.value.wait_until(
+          [&] { return (n = ring.try_push_many(items + pushed, count - pushed)) > 0; },
+          clock::time_point::max());
+      pushed += n;
+      // Let receivers drain what we've got so far if we are going to wait for room
+      state_->readable.value.notify();
+    }
+  }
+
+  bool try_pop(T &item) override { return try_pop_many(&item, 1) == 1; }
+
+  bool pop_until(T &item, clock::time_point deadline) override {
+    return pop_many_until(&item, 1, deadline) == 1;
+  }
+
+  std::size_t try_pop_many(T *items, std::size_t max) override {
+    std::size_t count = pop_lanes(items, max);
+    if (count > 0) {
+      state_->writable.value.notify();
+    }
+    return count;
+  }
+
+  std::size_t pop_many_until(T *items, std::size_t max, clock::time_point deadline) override {
+    return pop_many_until(items, max, deadline, wakeups());
+  }
+
+  // Number of `wake()` calls so far
+  std::uint32_t wakeups() const { return state_->wakeups.load(std::memory_order_acquire); }
+
+  // Also returns empty-handed once `wakeups()` is no longer `since`. Reading `since` before
+  // checking what the caller would be woken up for means a `wake()` in between isn't missed.
+  std::size_t pop_many_until(T *items, std::size_t max, clock::time_point deadline,
+                             std::uint32_t since) {
+    std::size_t count = 0;
+    if (max > 0) {
+      state_->readable.value.wait_until(
+          [&] { return (count = pop_lanes(items, max)) > 0 || wakeups() != since; }, deadline);
+    }
+    if (count > 0) {
+      state_->writable.value.notify();
+    }
+    return count;
+  }
+
+  std::size_t size() override {
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < state_->lanes; i++) {
+      size += state_->rings[i].size();
+    }
+    return size;
+  }
+
+  bool empty() override {
+    for (std::size_t i = 0; i < state_->lanes; i++) {
+      if (state_->rings[i].size() > 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void wake() override {
+    state_->wakeups.fetch_add(1, std::memory_order_release);
+    state_->readable.value.notify();
+  }
+
+private:
+  // What lives in the arena under the endpoint's name
+  struct state {
+    state(std::size_t capacity, std::size_t lanes, const allocator<T> &alloc)
+        : lanes(lanes), ring_alloc(alloc), rings(ring_alloc.allocate(lanes)) {
+      for (std::size_t i = 0; i < lanes; i++) {
+        std::construct_at(&rings[i], capacity, alloc);
+      }
+    }
+
+    ~state() {
+      for (std::size_t i = 0; i < lanes; i++) {
+        std::destroy_at(&rings[i]);
+      }
+      ring_alloc.deallocate(rings, lanes);
+    }
+
+    // Signalled when an item was pushed
+    cache_padded<notifier> readable;
+    // Signalled when an item was popped
+    cache_padded<notifier> writable;
+    // Bumped by `wake()`
+    std::atomic<std::uint32_t> wakeups{0};
+
+    std::size_t lanes;
+    allocator<Ring> ring_alloc;
+    bip::offset_ptr<Ring> rings;
+  };
+
+  // Priorities beyond the number of lanes go to the highest one
+  Ring &lane(unsigned int priority) {
+    return state_->rings[std::min<std::size_t>(priority, state_->lanes - 1)];
+  }
+
+  // Pops from the highest priority lanes first
+  std::size_t pop_lanes(T *items, std::size_t max) {
+    std::size_t count = 0;
+    for (std::size_t i = state_->lanes; i > 0 && count < max; i--) {
+      count += state_->rings[i - 1].try_pop_many(items + count, max - count);
+    }
+    return count;
+  }
+
+  state *state_;
+};
+
+// Keeps a separate queue per message type (by `T::hash`), named `<name>.<hash>`.
+//
+// Pushes are routed by type. Pops only look at the queues of the selected types (or all
+// known types if none are selected), so draining one type never touches another type's
+// entries. Waiting on a single type parks on that type's queue; waiting on several parks on
+// a doorbell shared by the endpoint that every push rings.
+template <typename T> struct typed_transport : transport<T> {
+  using typename transport<T>::clock;
+  using queue_factory = std::function<std::unique_ptr<transport<T>>(const char *name)>;
+
+  typed_transport(arena &arena, const char *name, queue_factory make_queue)
+      : name_(name), make_queue_(std::move(make_queue)),
+        doorbell_(arena.get_segment_manager()->find_or_construct<cache_padded<notifier>>(
+            (name_ + ".doorbell").c_str())()),
+        registry_(arena.get_segment_manager()->find_or_construct<type_registry>(
+            (name_ + ".types").c_str())(arena.get_segment_manager())) {}
+
+  // Restricts pops to the queues of these types; an empty list selects all known types
+  void select(std::initializer_list<std::size_t> hashes) {
+    if (hashes.size() == 0) {
+      all_ = true;
+      return;
+    }
+    if (!all_ && std::ranges::equal(hashes, selected_hashes_)) {
+      return;
+    }
+    all_ = false;
+    selected_hashes_.assign(hashes.begin(), hashes.end());
+    selected_.clear();
+    for (auto hash : hashes) {
+      selected_.push_back(&queue(hash));
+    }
+  }
+
+  void push(const T &item, unsigned int priority) override {
+    queue(item.hash).push(item, priority);
+    doorbell_->value.notify();
+  }
+
+  bool try_push(const T &item, unsigned int priority) override {
+    if (queue(item.hash).try_push(item, priority)) {
+      doorbell_->value.notify();
+      return true;
+    }
+    return false;
+  }
+
+  bool push_until(const T &item, unsigned int priority, clock::time_point deadline) override {
+    if (queue(item.hash).push_until(item, priority, deadline)) {
+      doorbell_->value.notify();
+      return true;
+    }
+    return false;
+  }
+
+  // Runs of the same type go to their queue at once
+  void push_many(const T *items, std::size_t count, unsigned int priority) override {
+    for (std::size_t i = 0; i < count;) {
+      std::size_t run = 1;
+      while (i + run < count && items[i + run].hash == items[i].hash) {
+        run++;
+      }
+      queue(items[i].hash).push_many(items + i, run, priority);
+      i += run;
+    }
+    doorbell_->value.notify();
+  }
+
+  bool try_pop(T &item) override { return try_pop_many(&item, 1) == 1; }
+
+  bool pop_until(T &item, clock::time_point deadline) override {
+    return pop_many_until(&item, 1, deadline) == 1;
+  }
+
+  std::size_t try_pop_many(T *items, std::size_t max) override {
+    std::size_t count = 0;
+    for (auto queue : sources()) {
+      if (count == max) {
+        break;
+      }
+      count += queue->try_pop_many(items + count, max - count);
+    }
+    return count;
+  }
+
+  std::size_t pop_many_until(T *items, std::size_t max, clock::time_point deadline) override {
+    auto &queues = sources();
+    if (queues.size() == 1) {
+      return queues.front()->pop_many_until(items, max, deadline);
+    }
+    std::size_t count = 0;
+    auto wakeups = registry_->wakeups.load(std::memory_order_acquire);
+    doorbell_->value.wait_until(
+        [&] {
+          return (count = try_pop_many(items, max)) > 0 ||
+                 registry_->wakeups.load(std::memory_order_acquire) != wakeups;
+        },
+        deadline);
+    return count;
+  }
+
+  std::size_t size() override {
+    std::size_t size = 0;
+    for (auto queue : sources()) {
+      size += queue->size();
+    }
+    return size;
+  }
+
+  bool empty() override {
+    return std::ranges::all_of(sources(), [](auto queue) { return queue->empty(); });
+  }
+
+  // Wakes up those waiting on a single type's queue as well
+  void wake() override {
+    registry_->wakeups.fetch_add(1, std::memory_order_release);
+    doorbell_->value.notify();
+    for (auto queue : all()) {
+      queue->wake();
+    }
+  }
+
+private:
+  // Types that were ever sent to (or waited for on) the endpoint
+  struct type_registry {
+    explicit type_registry(bip::managed_shared_memory::segment_manager *segment_manager)
+        : types(segment_manager) {}
+
+    shared_container<bc::vector<std::size_t, allocator<std::size_t>>, bip::interprocess_mutex>
+        types;
+    // Bumped on every addition so that readers know when to look again
+    std::atomic<std::size_t> version{0};
+    // Bumped by `wake()`
+    std::atomic<std::uint32_t> wakeups{0};
+  };
+
+  transport<T> &queue(std::size_t hash) {
+    auto it = queues_.find(hash);
+    if (it == queues_.end()) {
+      auto queue_name = name_ + "." + std::to_string(hash);
+      it = queues_.emplace(hash, make_queue_(queue_name.c_str())).first;
+      auto [lock, types] = registry_->types.scoped_lock();
+      if (std::ranges::find(types, hash) == types.end()) {
+        types.push_back(hash);
+        registry_->version.fetch_add(1, std::memory_order_release);
+      }
+    }
+    return *it->second;
+  }
+
+  std::vector<transport<T> *> &sources() { return all_ ? all() : selected_; }
+
+  // Queues of all known types
+  std::vector<transport<T> *> &all() {
+    if (auto version = registry_->version.load(std::memory_order_acquire);
+        version != known_version_) {
+      std::vector<std::size_t> hashes;
+      {
+        auto [lock, types] = registry_->types.scoped_lock();
+        hashes.assign(types.begin(), types.end());
+      }
+      known_.clear();
+      for (auto hash : hashes) {
+        known_.push_back(&queue(hash));
+      }
+      known_version_ = version;
+    }
+    return known_;
+  }
+
+  std::string name_;
+  queue_factory make_queue_;
+  cache_padded<notifier> *doorbell_;
+  type_registry *registry_;
+
+  std::unordered_map<std::size_t, std::unique_ptr<transport<T>>> queues_;
+  bool all_ = true;
+  std::vector<std::size_t> selected_hashes_;
+  std::vector<transport<T> *> selected_;
+  std::size_t known_version_ = 0;
+  std::vector<transport<T> *> known_;
+};
+
+// Splits an endpoint into partitions, each a queue of its own named `<name>.p<index>`, and
+// pushes entries to the partition in their `partition` field.
+//
+// Transports that pop (or `consume()`) join the endpoint's group of consumers and own the
+// partitions whose index modulo the group's size is their rank in it. They claim and release
+// partitions as consumers join and leave, and only ever pop from partitions they own, so
+// every partition is consumed by a single receiver at a time. A consumer that goes away
+// without leaving the group keeps its partitions.
+template <typename T> struct partitioned_transport : transport<T> {
+  using typename transport<T>::clock;
+  using queue_factory = std::function<std::unique_ptr<transport<T>>(const char *name)>;
+
+  static constexpr std::size_t max_consumers = 64;
+
+  partitioned_transport(arena &arena, const char *name, std::size_t partitions,
+                        queue_factory make_queue)
+      : group_(arena.get_segment_manager()->find_or_construct<group>(
+            (std::string(name) + ".group").c_str())()),
+        owners_(arena.get_segment_manager()->find_or_construct<std::atomic<std::uint64_t>>(
+            (std::string(name) + ".owners").c_str())[partitions](0)) {
+    for (std::size_t i = 0; i < partitions; i++) {
+      queues_.push_back(make_queue((std::string(name) + ".p" + std::to_string(i)).c_str()));
+    }
+  }
+
+  ~partitioned_transport() {
+    if (id_ != 0) {
+      leave();
+    }
+  }
+
+  partitioned_transport(const partitioned_transport &) = delete;
+  partitioned_transport &operator=(const partitioned_transport &) = delete;
+
+  void push(const T &item, unsigned int priority) override {
+    queue(item).push(item, priority);
+    group_->doorbell.value.notify();
+  }
+
+  bool try_push(const T &item, unsigned int priority) override {
+    if (queue(item).try_push(item, priority)) {
+      group_->doorbell.value.notify();
+      return true;
+    }
+    return false;
+  }
+
+  bool push_until(const T &item, unsigned int priority, clock::time_point deadline) override {
+    if (queue(item).push_until(item, priority, deadline)) {
+      group_->doorbell.value.notify();
+      return true;
+    }
+    return false;
+  }
+
+  // Runs for the same partition go to their queue at once
+  void push_many(const T *items, std::size_t count, unsigned int priority) override {
+    for (std::size_t i = 0; i < count;) {
+      std::size_t run = 1;
+      while (i + run < count && items[i + run].partition == items[i].partition) {
+        run++;
+      }
+      queue(items[i]).push_many(items + i, run, priority);
+      i += run;
+    }
+    group_->doorbell.value.notify();
+  }
+
+  bool try_pop(T &item) override { return try_pop_many(&item, 1) == 1; }
+
+  bool pop_until(T &item, clock::time_point deadline) override {
+    return pop_many_until(&item, 1, deadline) == 1;
+  }
+
+  std::size_t try_pop_many(T *items, std::size_t max) override {
+    rebalance();
+    return pop_owned(items, max);
+  }
+
+  // Also wakes up when partitions change hands
+  std::size_t pop_many_until(T *items, std::size_t max, clock::time_point deadline) override {
+    std::size_t count = 0;
+    auto wakeups = group_->wakeups.load(std::memory_order_acquire);
+    group_->doorbell.value.wait_until(
+        [&] {
+          rebalance();
+          return (count = pop_owned(items, max)) > 0 ||
+                 group_->wakeups.load(std::memory_order_acquire) != wakeups;
+        },
+        deadline);
+    return count;
+  }
+
+  // Consumers only count the partitions they own
+  std::size_t size() override {
+    std::size_t size = 0;
+    for (auto index : sources()) {
+      size += queues_[index]->size();
+    }
+    return size;
+  }
+
+  bool empty() override {
+    return std::ranges::all_of(sources(), [this](auto index) { return queues_[index]->empty(); });
+  }
+
+  void wake() override {
+    group_->wakeups.fetch_add(1, std::memory_order_release);
+    group_->doorbell.value.notify();
+  }
+
+  std::size_t partitions() const { return queues_.size(); }
+
+  // Joins the consumers, if not done yet, and takes over the partitions that are due
+  void consume() { rebalance(); }
+
+  // Partitions this transport consumes
+  const std::vector<std::size_t> &owned() const { return owned_; }
+
+private:
+  struct group {
+    // Ids of the consumers, zero for free slots
+    std::atomic<std::uint64_t> members[max_consumers]{};
+    std::atomic<std::uint64_t> next_id{0};
+    // Bumped whenever consumers join or leave or a partition is released
+    std::atomic<std::size_t> version{0};
+    // Bumped by `wake()`
+    std::atomic<std::uint32_t> wakeups{0};
+    cache_padded<notifier> doorbell;
+  };
+
+  transport<T> &queue(const T &item) { return *queues_[item.partition % queues_.size()]; }
+
+  std::size_t pop_owned(T *items, std::size_t max) {
+    std::size_t count = 0;
+    for (auto index : owned_) {
+      if (count == max) {
+        break;
+      }
+      count += queues_[index]->try_pop_many(items + count, max - count);
+    }
+    return count;
+  }
+
+  // Owned partitions for consumers, all of them otherwise
+  std::vector<std::size_t> &sources() {
+    if (id_ == 0) {
+      if (all_.size() != queues_.size()) {
+        all_.resize(queues_.size());
+        std::iota(all_.begin(), all_.end(), std::size_t{0});
+      }
+      return all_;
+    }
+    rebalance();
+    return owned_;
+  }
+
+  void join() {
+    id_ = group_->next_id.fetch_add(1) + 1;
+    for (auto &member : group_->members) {
+      std::uint64_t free = 0;
+      if (member.compare_exchange_strong(free, id_)) {
+        changed();
+        return;
+      }
+    }
+    id_ = 0;
+    throw std::runtime_error("too many consumers of a partitioned endpoint");
+  }
+
+  void leave() {
+    for (auto index : owned_) {
+      owners_[index].store(0);
+    }
+    owned_.clear();
+    for (auto &member : group_->members) {
+      auto id = id_;
+      if (member.compare_exchange_strong(id, 0)) {
+        break;
+      }
+    }
+    changed();
+  }
+
+  void changed() {
+    group_->version.fetch_add(1);
+    group_->doorbell.value.notify();
+  }
+
+  // Releases the partitions that are no longer ours and claims those that are (once their
+  // previous owners have released them)
+  void rebalance() {
+    if (id_ == 0) {
+      join();
+    }
+    auto version = group_->version.load();
+    if (version == seen_version_ && owned_.size() == wanted_) {
+      return;
+    }
+    seen_version_ = version;
+
+    std::size_t consumers = 0, rank = 0;
+    for (auto &member : group_->members) {
+      if (auto id = member.load(); id != 0) {
+        consumers++;
+        rank += id < id_;
+      }
+    }
+    consumers = std::max<std::size_t>(consumers, 1);
+
+    bool released = false;
+    std::erase_if(owned_, [&](auto index) {
+      if (index % consumers == rank) {
+        return false;
+      }
+      owners_[index].store(0);
+      released = true;
+      return true;
+    });
+    wanted_ = 0;
+    for (std::size_t index = rank; index < queues_.size(); index += consumers) {
+      wanted_++;
+      if (std::ranges::find(owned_, index) != owned_.end()) {
+        continue;
+      }
+      std::uint64_t free = 0;
+      if (owners_[index].compare_exchange_strong(free, id_)) {
+        owned_.push_back(index);
+      }
+    }
+    if (released) {
+      changed();
+    }
+  }
+
+  group *group_;
+  std::atomic<std::uint64_t> *owners_;
+  std::vector<std::unique_ptr<transport<T>>> queues_;
+  // Zero until this transport pops for the first time
+  std::uint64_t id_ = 0;
+  std::size_t seen_version_ = 0;
+  std::size_t wanted_ = 0;
+  std::vector<std::size_t> owned_;
+  std::vector<std::size_t> all_;
+};
+
+// Hierarchical timer wheel living in the arena, holding entries until they are due.
+//
+// Ticks are a millisecond long. Four levels of 64 slots cover about 4.6 hours; entries due
+// later than that wait in the top level's last slot and are placed again when it cascades.
+// Scheduling an entry, moving it down a level and taking it out once due are all O(1).
+// The wheel is advanced by whoever calls `advance()`, one at a time. Entries due in the same
+// tick come out in no particular order.
+template <typename T> struct timer_wheel {
+  using clock = std::chrono::steady_clock;
+
+  static constexpr std::size_t levels = 4;
+  static constexpr std::size_t slot_bits = 6;
+  static constexpr std::size_t slots = std::size_t{1} << slot_bits;
+
+  explicit timer_wheel(bip::managed_shared_memory::segment_manager *segment_manager)
+      : alloc_(segment_manager), current_(floor_tick(clock::now())) {}
+
+  timer_wheel(const timer_wheel &) = delete;
+  timer_wheel &operator=(const timer_wheel &) = delete;
+
+  // Returns `true` if waiters have to be woken up for the entry: it's now the first one due,
+  // and somebody may be parked past it
+  bool schedule(const T &item, clock::time_point due) {
+    auto n = alloc_.allocate(1);
+    std::construct_at(n.get(), item, std::chrono::ceil<std::chrono::milliseconds>(
+                                         due.time_since_epoch())
+                                         .count());
+    bip::scoped_lock<bip::interprocess_mutex> lock(mutex_);
+    if (count_ == 0) {
+      // Nobody advances an empty wheel; catch up so that `advance()` doesn't walk the gap
+      current_ = std::max(current_, floor_tick(clock::now()));
+    }
+    n->due = std::max(n->due, current_ + 1);
+    insert(n);
+    count_++;
+    if (n->due < next_due_.load(std::memory_order_relaxed)) {
+      next_due_.store(n->due, std::memory_order_seq_cst);
+      // Woken waiters say again how long they park, so until then, earlier entries don't need
+      // to wake them up once more
+      auto parked = parked_until_.load(std::memory_order_seq_cst);
+      while (parked > n->due) {
+        if (parked_until_.compare_exchange_weak(parked, std::numeric_limits<std::int64_t>::min(),
+                                                std::memory_order_seq_cst)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Takes the entries that are due by `now` out of the wheel and hands them to `push`, which
+  // returns `false` if it can't take one right now (it's then retried on the next tick).
+  // Returns the number of entries pushed; does nothing if somebody else is advancing the
+  // wheel.
+  template <typename Push> std::size_t advance(clock::time_point now, Push &&push) {
+    auto now_tick = floor_tick(now);
+    if (next_due_.load(std::memory_order_acquire) > now_tick) {
+      return 0;
+    }
+    bip::scoped_lock<bip::interprocess_mutex> lock(mutex_, bip::try_to_lock);
+    if (!lock.owns()) {
+      return 0;
+    }
+    // Due entries in the order they're pushed in
+    bip::offset_ptr<node> due, *tail = &due;
+    while (current_ < now_tick && count_ > 0) {
+      current_++;
+      for (std::size_t level = 1; level < levels; level++) {
+        if ((current_ & ((std::int64_t{1} << (slot_bits * level)) - 1)) != 0) {
+          break;
+        }
+        cascade(level);
+      }
+      auto &slot = wheel_[0][current_ & (slots - 1)];
+      for (auto n = slot; n != nullptr; n = n->next) {
+        *tail = n;
+        tail = &n->next;
+        count_--;
+      }
+      slot = nullptr;
+    }
+    current_ = std::max(current_, now_tick);
+
+    std::size_t pushed = 0;
+    while (due != nullptr) {
+      auto n = due;
+      due = n->next;
+      if (push(n->item)) {
+        std::destroy_at(n.get());
+        alloc_.deallocate(n, 1);
+        pushed++;
+      } else {
+        n->due = current_ + 1;
+        insert(n);
+        count_++;
+      }
+    }
+    update_next_due();
+    return pushed;
+  }
+
+  // When the first entry may be due; `time_point::max()` if there are none
+  clock::time_point next_due() const { return to_time(next_due_.load(std::memory_order_acquire)); }
+
+  // `next_due()`, for a waiter about to park until then at the latest. `schedule()` only asks
+  // for waiters to be woken up for entries due before that.
+  clock::time_point park_until() {
+    auto tick = next_due_.load(std::memory_order_seq_cst);
+    for (;;) {
+      auto parked = parked_until_.load(std::memory_order_seq_cst);
+      while (parked < tick &&
+             !parked_until_.compare_exchange_weak(parked, tick, std::memory_order_seq_cst)) {
+      }
+      // An entry scheduled in between may not have seen what we recorded
+      auto again = next_due_.load(std::memory_order_seq_cst);
+      if (again == tick) {
+        return to_time(tick);
+      }
+      tick = again;
+    }
+  }
+
+private:
+  struct node {
+    node(const T &item, std::int64_t due) : item(item), due(due) {}
+
+    T item;
+    std::int64_t due;
+    bip::offset_ptr<node> next;
+  };
+
+  static clock::time_point to_time(std::int64_t tick) {
+    if (tick == std::numeric_limits<std::int64_t>::max()) {
+      return clock::time_point::max();
+    }
+    return clock::time_point(std::chrono::milliseconds(tick));
+  }
+
+  static std::int64_t floor_tick(clock::time_point time) {
+    return std::chrono::floor<std::chrono::milliseconds>(time.time_since_epoch()).count();
+  }
+
+  static constexpr std::int64_t span(std::size_t level) {
+    return std::int64_t{1} << (slot_bits * level);
+  }
+
+  void insert(bip::offset_ptr<node> n) {
+    auto delta = n->due - current_;
+    std::size_t level = 0;
+    while (level + 1 < levels && delta >= span(level + 1)) {
+      level++;
+    }
+    // Too far out: waits for the top level to come around
+    auto due = delta >= span(levels) ? current_ + span(levels) - span(levels - 1) : n->due;
+    auto &slot = wheel_[level][(due >> (slot_bits * level)) & (slots - 1)];
+    n->next = slot;
+    slot = n;
+  }
+
+  // Places the entries of the current slot of `level` again, now that they're closer
+  void cascade(std::size_t level) {
+    auto &slot = wheel_[level][(current_ >> (slot_bits * level)) & (slots - 1)];
+    auto n = slot;
+    slot = nullptr;
+    while (n != nullptr) {
+      auto next = n->next;
+      insert(n);
+      n = next;
+    }
+  }
+
+  // Lower bound of the first due tick: the first occupied slot ahead on every level
+  void update_next_due() {
+    auto next_due = std::numeric_limits<std::int64_t>::max();
+    if (count_ > 0) {
+      for (std::size_t level = 0; level < levels; level++) {
+        auto block = current_ >> (slot_bits * level);
+        for (std::int64_t b = block + 1; b <= block + static_cast<std::int64_t>(slots); b++) {
+          if (wheel_[level][b & (slots - 1)] != nullptr) {
+            next_due = std::min(next_due, b << (slot_bits * level));
+            break;
+          }
+        }
+      }
+    }
+    next_due_.store(next_due, std::memory_order_release);
+  }
+
+  allocator<node> alloc_;
+  bip::interprocess_mutex mutex_;
+  // Last tick that was processed
+  std::int64_t current_;
+  std::size_t count_ = 0;
+  std::atomic<std::int64_t> next_due_{std::numeric_limits<std::int64_t>::max()};
+  // Latest tick waiters said they park until, minimum if none parked since they were last
+  // woken up. Waiters parked before the wheel existed haven't said, so it starts out as late
+  // as it gets.
+  std::atomic<std::int64_t> parked_until_{std::numeric_limits<std::int64_t>::max()};
+  bip::offset_ptr<node> wheel_[levels][slots];
+};
+
+// Latest message per key of a conflating endpoint, living in the arena. A key gets a slot the
+// first time it's seen and keeps it; the table has room for a fixed number of keys, which are
+// told apart by their hash. Each slot has its own lock, so only updates of the same key
+// contend.
+template <typename T> struct conflation_table {
+  struct offer_result {
+    bool queued;
+    // Item that was pending for the key before, if any
+    std::optional<T> superseded = std::nullopt;
+  };
+
+  conflation_table(bip::managed_shared_memory::segment_manager *segment_manager,
+                   std::size_t size)
+      : size_(size), slots_(allocator<slot>(segment_manager).allocate(size)) {
+    std::uninitialized_default_construct_n(slots_.get(), size);
+  }
+
+  conflation_table(const conflation_table &) = delete;
+  conflation_table &operator=(const conflation_table &) = delete;
+
+  // Slot of the key, claiming a free one if it's new; nothing if the table is full
+  std::optional<std::size_t> find(std::size_t type, std::size_t key) {
+    auto start = (type ^ (key * 0x9e3779b97f4a7c15)) % size_;
+    for (std::size_t i = 0; i < size_; i++) {
+      auto index = (start + i) % size_;
+      auto &s = slots_[index];
+      auto state = s.state.load(std::memory_order_acquire);
+      if (state == slot::empty && s.state.compare_exchange_strong(state, slot::claiming)) {
+        s.type = type;
+        s.key = key;
+        s.state.store(slot::ready, std::memory_order_release);
+        return index;
+      }
+      while (state == slot::claiming) {
+        std::this_thread::yield();
+        state = s.state.load(std::memory_order_acquire);
+      }
+      if (s.type == type && s.key == key) {
+        return index;
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Makes `item` the latest for the slot. If an entry for the slot is queued already, `item`
+  // replaces the one it stands for; otherwise `queue()` is called to queue one and returns
+  // whether it did.
+  template <typename Queue> offer_result offer(std::size_t index, const T &item, Queue &&queue) {
+    auto &s = slots_[index];
+    bip::scoped_lock<bip::interprocess_mutex> lock(s.mutex);
+    if (s.pending) {
+      return {.queued = true, .superseded = std::exchange(s.latest, item)};
+    }
+    if (!queue()) {
+      return {.queued = false};
+    }
+    s.latest = item;
+    s.pending = true;
+    return {.queued = true};
+  }
+
+  // Takes the latest item out of the slot once its queue entry was dequeued
+  std::optional<T> take(std::size_t index) {
+    auto &s = slots_[index];
+    bip::scoped_lock<bip::interprocess_mutex> lock(s.mutex);
+    if (!s.pending) {
+      return std::nullopt;
+    }
+    s.pending = false;
+    return s.latest;
+  }
+
+private:
+  struct slot {
+    static constexpr int empty = 0;
+    static constexpr int claiming = 1;
+    static constexpr int ready = 2;
+
+    std::atomic<int> state{empty};
+    std::size_t type = 0;
+    std::size_t key = 0;
+    bip::interprocess_mutex mutex;
+    // Whether an entry for the slot is queued
+    bool pending = false;
+    T latest{};
+  };
+
+  std::size_t size_;
+  bip::offset_ptr<slot> slots_;
+};
+
+// What a receiver does while its queue is empty
+enum class wait_strategy {
+  // Keep polling the queue; lowest latency, burns a core
+  busy_spin,
+  // Poll `spin_count` times, then keep yielding the CPU between polls
+  spin_then_yield,
+  // Poll `spin_count` times, then block in the transport
+  spin_then_park,
+  // Block in the transport right away
+  park,
+};
+
+struct wait_policy {
+  wait_strategy strategy = wait_strategy::park;
+  std::size_t spin_count = 1000;
+};
+
+// Counts how receives were satisfied, by the phase of the wait policy that got the message
+struct wait_stats {
+  // Message was already there
+  std::size_t immediate = 0;
+  // Message arrived while spinning
+  std::size_t spun = 0;
+  // Message arrived while yielding
+  std::size_t yielded = 0;
+  // Message arrived while parked
+  std::size_t parked = 0;
+  // Deadline passed without a message
+  std::size_t timed_out = 0;
+  // Total number of polls done while spinning
+  std::size_t spins = 0;
+  // Messages dropped without being handled as they expired
+  std::size_t expired = 0;
+};
+
+// Message priority, higher values are received first. Passed as the first argument to
+// `sender::send`.
+struct priority {
+  unsigned int value = 0;
+};
+
+// Time after which a message is no longer worth handling, passed to `sender::send` after the
+// priority (if any). The default one never passes.
+struct expiry {
+  std::chrono::steady_clock::time_point at{};
+
+  static expiry after(std::chrono::steady_clock::duration ttl) {
+    return {std::chrono::steady_clock::now() + ttl};
+  }
+};
+
+// How long a receiver holds on to a message its visitor rejected before offering it again
+struct retry_policy {
+  std::chrono::microseconds initial_delay{100};
+  // The delay doubles with every rejection of the same message, up to this
+  std::chrono::microseconds max_delay = std::chrono::milliseconds(100);
+};
+
+// Fixed-size blocks of one size class, living in the arena. Threads allocate and free blocks
+// through their own `magazine_cache` and only come to the pool for a whole magazine of them
+// at a time: full magazines are kept on a lock-free stack for any thread (of any process) to
+// take, and new ones are carved out of the arena when there are none. Blocks are never given
+// back to the arena.
+struct slab_pool {
+  static constexpr std::size_t alignment = alignof(std::max_align_t);
+  // Blocks moved between a thread's cache and the pool at a time
+  static constexpr std::size_t magazine_size = 32;
+
+  // Chain of free blocks
+  struct magazine {
+    std::uint64_t first = 0;
+    std::size_t count = 0;
+  };
+
+  slab_pool(bip::managed_shared_memory::segment_manager *segment_manager, std::size_t block_size)
+      : segment_manager_(segment_manager), block_size_(block_size) {}
+
+  slab_pool(const slab_pool &) = delete;
+  slab_pool &operator=(const slab_pool &) = delete;
+
+  // Size class of an object of `size` bytes
+  static constexpr std::size_t size_class(std::size_t size) {
+    return (std::max(size, sizeof(block)) + alignment - 1) / alignment * alignment;
+  }
+
+  std::size_t block_size() const { return block_size_; }
+
+  // Takes a block out of a non-empty magazine
+  void *pop(magazine &m) {
+    auto b = at(m.first);
+    m.first = b->next;
+    m.count--;
+    return b;
+  }
+
+  void push(magazine &m, void *p) {
+    auto b = std::construct_at(static_cast<block *>(p));
+    b->next = m.first;
+    m.first = link(b);
+    m.count++;
+  }
+
+  // A magazine given back to the pool, or a new full one; empty if the arena is full
+  magazine take() {
+    auto head = depot_.load(std::memory_order_acquire);
+    while ((head & offset_mask) != 0) {
+      auto b = at(head);
+      // `b` may be taken and written to meanwhile; the tag makes the exchange fail then
+      auto next = b->next_magazine.load(std::memory_order_relaxed);
+      auto count = b->count.load(std::memory_order_relaxed);
+      if (depot_.compare_exchange_weak(head, retag(next, head), std::memory_order_acquire)) {
+        return {.first = head & offset_mask, .count = count};
+      }
+    }
+    return carve();
+  }
+
+  void put(magazine m) {
+    if (m.count == 0) {
+      return;
+    }
+    auto b = at(m.first);
+    b->count.store(m.count, std::memory_order_relaxed);
+    auto head = depot_.load(std::memory_order_relaxed);
+    do {
+      b->next_magazine.store(head & offset_mask, std::memory_order_relaxed);
+    } while (!depot_.compare_exchange_weak(head, retag(m.first, head), std::memory_order_release,
+                                           std::memory_order_relaxed));
+  }
+
+private:
+  // What a free block starts with
+  struct block {
+    // Next block of the magazine
+    std::uint64_t next = 0;
+    // Set on the first block of a magazine while the pool holds it
+    std::atomic<std::uint64_t> next_magazine{0};
+    std::atomic<std::size_t> count{0};
+  };
+
+  // Links are the block's offset from the segment manager, in units of `alignment`, in the low
+  // 48 bits (zero for none) and, for the top of the stack, a tag against ABA in the high 16
+  // bits
+  static constexpr int offset_bits = 48;
+  static constexpr std::uint64_t offset_mask = (std::uint64_t{1} << offset_bits) - 1;
+
+  block *at(std::uint64_t link) {
+    return reinterpret_cast<block *>(reinterpret_cast<char *>(segment_manager_.get()) +
+                                     (link & offset_mask) * alignment);
+  }
+
+  std::uint64_t link(block *b) {
+    return static_cast<std::uint64_t>(reinterpret_cast<char *>(b) -
+                                      reinterpret_cast<char *>(segment_manager_.get())) /
+           alignment;
+  }
+
+  // `link` with the tag following that of `head`
+  static std::uint64_t retag(std::uint64_t link, std::uint64_t head) {
+    return (link & offset_mask) | (((head >> offset_bits) + 1) << offset_bits);
+  }
+
+  magazine carve() {
+    auto chunk = static_cast<char *>(
+        segment_manager_->allocate(block_size_ * magazine_size, std::nothrow));
+    magazine m;
+    if (chunk != nullptr) {
+      for (std::size_t i = magazine_size; i > 0; i--) {
+        push(m, chunk + (i - 1) * block_size_);
+      }
+    }
+    return m;
+  }
+
+  bip::offset_ptr<bip::managed_shared_memory::segment_manager> segment_manager_;
+  std::size_t block_size_;
+  // Magazines given back
+  std::atomic<std::uint64_t> depot_{0};
+};
+
+// Slab pool blocks a thread keeps at hand: up to two magazines per pool, so that allocating
+// and freeing envelopes mostly touches nothing other threads do. Blocks freed by a thread
+// (whichever thread allocated them) go into its own magazines; when both are full, one goes
+// back to the pool, and when both are empty, one is taken from it.
+//
+// Magazines go back to their pools when the thread exits or the `arena` object they belong
+// to is destroyed, whichever comes first.
+struct magazine_cache {
+  static void *allocate(arena &arena, slab_pool &pool) {
+    auto &e = local().find(arena, pool);
+    if (e.loaded.count == 0) {
+      if (e.previous.count > 0) {
+        std::swap(e.loaded, e.previous);
+      } else {
+        e.loaded = pool.take();
+        if (e.loaded.count == 0) {
+          return nullptr;
+        }
+      }
+    }
+    return pool.pop(e.loaded);
+  }
+
+  static void deallocate(arena &arena, slab_pool &pool, void *p) {
+    auto &e = local().find(arena, pool);
+    if (e.loaded.count == slab_pool::magazine_size) {
+      if (e.previous.count == slab_pool::magazine_size) {
+        pool.put(e.previous);
+        e.previous = {};
+      }
+      std::swap(e.loaded, e.previous);
+    }
+    pool.push(e.loaded, p);
+  }
+
+  magazine_cache(const magazine_cache &) = delete;
+  magazine_cache &operator=(const magazine_cache &) = delete;
+
+  ~magazine_cache() {
+    for (auto &e : entries_) {
+      std::lock_guard lock(e->lifetime->mutex);
+      if (e->lifetime->alive) {
+        e->flush();
+        e->lifetime->caches.erase(e.get());
+      }
+    }
+  }
+
+private:
+  magazine_cache() = default;
+
+  struct entry {
+    void flush() {
+      pool->put(std::exchange(loaded, {}));
+      pool->put(std::exchange(previous, {}));
+    }
+
+    slab_pool *pool;
+    std::shared_ptr<arena_lifetime> lifetime;
+    slab_pool::magazine loaded;
+    slab_pool::magazine previous;
+  };
+
+  static magazine_cache &local() {
+    thread_local magazine_cache cache;
+    return cache;
+  }
+
+  entry &find(arena &arena, slab_pool &pool) {
+    for (auto &e : entries_) {
+      if (e->pool == &pool && e->lifetime->alive.load(std::memory_order_relaxed)) {
+        return *e;
+      }
+    }
+    // Forgets about arenas that are gone, whose pools' addresses may be reused
+    std::erase_if(entries_, [](auto &e) { return !e->lifetime->alive; });
+    auto &e = *entries_.emplace_back(
+        new entry{.pool = &pool, .lifetime = arena.lifetime_, .loaded = {}, .previous = {}});
+    std::lock_guard lock(e.lifetime->mutex);
+    e.lifetime->caches.emplace(&e, [&e] { e.flush(); });
+    return e;
+  }
+
+  std::vector<std::unique_ptr<entry>> entries_;
+};
+
+// Flow control limits of an endpoint; zero means no limit
+struct credit_limits {
+  // Bytes of envelopes
+  std::size_t bytes = 0;
+  std::size_t messages = 0;
+};
+
+// Credits for the messages sent to an endpoint, kept in the arena. Senders take credits
+// before allocating an envelope and the envelope gives them back when it's freed, so the
+// messages (and envelope bytes) in flight stay within the limits: queued or still held by
+// receipts, on either side.
+struct credit_pool {
+  explicit credit_pool(const credit_limits &limits) : limits_(limits) {}
+
+  // A message that's larger than the byte limit only goes through while nothing else is in
+  // flight
+  bool try_acquire(std::size_t bytes, std::size_t messages) {
+    if (!take(messages_, messages, limits_.messages)) {
+      return false;
+    }
+    if (!take(bytes_, bytes, limits_.bytes)) {
+      messages_.fetch_sub(messages);
+      return false;
+    }
+    return true;
+  }
+
+  bool acquire_until(std::size_t bytes, std::size_t messages,
+                     notifier::clock::time_point deadline) {
+    return granted_.value.wait_until([&] { return try_acquire(bytes, messages); }, deadline);
+  }
+
+  void release(arena &arena, std::size_t bytes, std::size_t messages) {
+    bytes_.fetch_sub(bytes);
+    messages_.fetch_sub(messages);
+    granted_.value.notify();
+    watchers_.notify(arena);
+  }
+
+  // Signalled whenever credits are given back, for those that can't block on `acquire_until()`
+  watch_list &watchers() { return watchers_; }
+
+  std::size_t bytes_in_flight() const { return bytes_.load(std::memory_order_relaxed); }
+
+  std::size_t messages_in_flight() const { return messages_.load(std::memory_order_relaxed); }
+
+private:
+  static bool take(std::atomic<std::size_t> &used, std::size_t amount, std::size_t limit) {
+    if (limit == 0) {
+      used.fetch_add(amount);
+      return true;
+    }
+    auto current = used.load();
+    do {
+      if (current != 0 && current + amount > limit) {
+        return false;
+      }
+    } while (!used.compare_exchange_weak(current, current + amount));
+    return true;
+  }
+
+  credit_limits limits_;
+  std::atomic<std::size_t> bytes_{0};
+  std::atomic<std::size_t> messages_{0};
+  cache_padded<notifier> granted_;
+  watch_list watchers_;
+};
+
+struct endpoint_options {
+  transport_kind transport = transport_kind::message_queue;
+  // Used by receivers whenever the queue is empty
+  wait_policy wait = {};
+  // Used by receivers for messages their visitor rejected
+  retry_policy retry = {};
+  // Number of priority lanes kept by ring transports, each holding up to `mq_max_messages`
+  // entries. Priorities at or above it share the highest lane.
+  std::size_t priorities = 1;
+  // Keep a separate queue (of the chosen transport) per message type, so that receivers only
+  // ever dequeue and wait for the types they handle. With `message_queue`, the per-type queues
+  // are `mpmc_ring`s in the arena (with `priorities` lanes) instead, so that they go away
+  // along with it.
+  bool per_type_queues = false;
+  // Split the endpoint into this many partitions (if more than one), each consumed by a
+  // single receiver at a time. Messages with a `partition_key()` member go to the partition
+  // its hash picks, so messages with the same key stay in order; other messages are spread
+  // over the partitions. Can't be combined with `per_type_queues`.
+  std::size_t partitions = 0;
+  // Flow control for senders; see `credit_pool`. The endpoint keeps the limits it was first
+  // created with.
+  credit_limits credits = {};
+  // Conflate messages with a `conflation_key()` member, for up to this many distinct keys
+  // (across all types): a message sent while another one with the same key is still queued
+  // replaces it, and the replaced one is released right away. Only the latest message per
+  // key is ever received, and a key takes up at most one entry in the queue. Messages of keys
+  // that don't fit any more are queued as usual, as are those sent with `send_at()` or
+  // batches.
+  std::size_t conflation_keys = 0;
+  // Senders allocate envelopes from per-size-class `slab_pool`s shared through the arena.
+  // Memory in them is reused for envelopes of the same size class but never given back to
+  // the arena.
+  bool slab_pools = false;
+};
+
+struct endpoint {
+
+  struct msg {
+    std::size_t hash;
+    std::ptrdiff_t offset;
+    unsigned int priority;
+    // Set for partitioned endpoints
+    unsigned int partition = 0;
+    // `steady_clock` ticks after which the message is dropped unhandled, zero for never. Kept
+    // in the entry so that expired entries can be skipped without reading their envelopes.
+    std::int64_t expires = 0;
+  };
+
+  endpoint(arena &arena, const char *mq_segment_name, size_t mq_max_messages,
+           endpoint_options options = {})
+      : arena_(arena), options_(options),
+        transport_(make_transport(arena, mq_segment_name, mq_max_messages, options)),
+        typed_(dynamic_cast<typed_transport<msg> *>(transport_.get())),
+        partitioned_(dynamic_cast<partitioned_transport<msg> *>(transport_.get())),
+        timers_name_(std::string(mq_segment_name) + ".timers"),
+        conflated_(options.conflation_keys == 0
+                       ? nullptr
+                       : arena.get_segment_manager()->find_or_construct<conflation_table<msg>>(
+                             (std::string(mq_segment_name) + ".conflation").c_str())(
+                             arena.get_segment_manager(), options.conflation_keys)),
+        credits_(options.credits.bytes == 0 && options.credits.messages == 0
+                     ? nullptr
+                     : arena.get_segment_manager()->find_or_construct<credit_pool>(
+                           (std::string(mq_segment_name) + ".credits").c_str())(options.credits)),
+        watchers_(arena.get_segment_manager()->find_or_construct<watchers>(
+            (std::string(mq_segment_name) + ".watchers").c_str())()),
+        msgs_(arena.get_segment_manager()->find_or_construct<msg_vec>("__msgs")(
+            arena.get_segment_manager())) {}
+
+  template <typename T> auto get_allocator() { return arena_.get_allocator<T>(); }
+
+  template <typename T> T &get_msg(std::ptrdiff_t index) {
+    void *addr = static_cast<char *>(arena_.segment.get_address()) + index;
+    return reinterpret_cast<T &>(addr);
+  }
+
+  // Why a receiver's `native_handle()` couldn't be signalled the last time it couldn't be;
+  // messages are sent all the same. Such handles are tried again on the next send.
+  const std::error_code &signal_error() const { return signal_error_; }
+
+protected:
+  friend struct publisher;
+
+  using msg_allocator_t = allocator<msg>;
+  using msg_vec =
+      shared_container<bc::vector<msg, msg_allocator_t>, bip::interprocess_recursive_mutex>;
+
+  struct transport_layout {
+    transport_layout(transport_kind kind, bool per_type_queues, std::size_t partitions,
+                     std::size_t conflation_keys)
+        : kind(kind), per_type_queues(per_type_queues), partitions(partitions),
+          conflation_keys(conflation_keys) {}
+
+    bool operator==(const transport_layout &) const = default;
+
+    transport_kind kind;
+    bool per_type_queues;
+    std::size_t partitions;
+    std::size_t conflation_keys;
+  };
+
+  // Queue entry for a message, with the partition it goes to
+  template <message M>
+  msg entry(const M &message, std::ptrdiff_t offset, unsigned int priority) {
+    auto m = msg{.hash = message_tag<M>(), .offset = offset, .priority = priority};
+    if (auto partitions = options_.partitions; partitions > 1) {
+      if constexpr (requires { message.partition_key(); }) {
+        auto key = message.partition_key();
+        m.partition = static_cast<unsigned int>(std::hash<decltype(key)>{}(key) % partitions);
+      } else {
+        m.partition = static_cast<unsigned int>(next_partition_++ % partitions);
+      }
+    }
+    return m;
+  }
+
+  struct watchers {
+    // Signalled when entries are queued
+    watch_list readable;
+    // Signalled when entries are dequeued, making room
+    watch_list writable;
+    // Receivers' event handles, signalled when entries are queued into an empty endpoint
+    poll_list pollers;
+    // Set once the endpoint's timer wheel exists
+    std::atomic<bool> timers = false;
+  };
+
+  // Failures to signal receivers' event handles are kept in `signal_error_`; the entries are
+  // queued all the same
+  void signal_queued() {
+    watchers_->readable.notify(arena_);
+    watchers_->pollers.notify(signal_error_);
+  }
+
+  void signal_dequeued() { watchers_->writable.notify(arena_); }
+
+  // Entries of conflating endpoints stand for the latest message of their key, and refer to
+  // its conflation slot with a negative offset
+  static msg conflated_entry(const msg &m, std::size_t index) {
+    auto entry = m;
+    entry.offset = -1 - static_cast<std::ptrdiff_t>(index);
+    entry.expires = 0;
+    return entry;
+  }
+
+  // Turns a dequeued entry into that of the message it stands for. Returns `false` for
+  // entries without one.
+  bool claim(msg &m) {
+    if (m.offset < 0) {
+      auto latest = conflated_->take(static_cast<std::size_t>(-1 - m.offset));
+      if (!latest) {
+        return false;
+      }
+      m = *latest;
+    }
+    return true;
+  }
+
+  // The endpoint's timer wheel, which the first `send_at()` creates (`create`); null until
+  // then
+  timer_wheel<msg> *timers(bool create) {
+    if (timers_ == nullptr && (create || watchers_->timers.load(std::memory_order_acquire))) {
+      auto *segment_manager = arena_.get_segment_manager();
+      timers_ = segment_manager->find_or_construct<timer_wheel<msg>>(timers_name_.c_str())(
+          segment_manager);
+      watchers_->timers.store(true, std::memory_order_release);
+    }
+    return timers_;
+  }
+
+  // Moves scheduled messages that are due over to the queue
+  void release_timers() {
+    auto *wheel = timers(false);
+    if (wheel == nullptr) {
+      return;
+    }
+    auto pushed = wheel->advance(transport<msg>::clock::now(), [this](const msg &m) {
+      return transport_->try_push(m, m.priority);
+    });
+    if (pushed > 0) {
+      signal_queued();
+    }
+  }
+
+  // Narrows a per-type transport (and the receiver's deferred messages) down to the types
+  // about to be received; no types means all of them
+  template <message... Msg> void select() {
+    selected_.assign({message_tag<Msg>()...});
+    if (typed_ != nullptr) {
+      typed_->select({message_tag<Msg>()...});
+    }
+  }
+
+  bool selected(std::size_t hash) const {
+    return selected_.empty() || std::ranges::find(selected_, hash) != selected_.end();
+  }
+
+  static std::unique_ptr<transport<msg>> make_transport(arena &arena, const char *name,
+                                                         std::size_t max_messages,
+                                                         const endpoint_options &options) {
+    auto kind = options.transport;
+    // Every endpoint records the transport it was created with, as attaching to it with a
+    // different one would reinterpret somebody else's queue
+    auto partitions = options.partitions > 1 ? options.partitions : 0;
+    transport_layout layout(kind, options.per_type_queues, partitions, options.conflation_keys);
+    auto recorded = arena.get_segment_manager()->find_or_construct<transport_layout>(
+        (std::string(name) + ".transport").c_str())(layout);
+    if (!(*recorded == layout)) {
+      throw std::invalid_argument(std::string("endpoint ") + name +
+                                  " was created with a different transport");
+    }
+    if (partitions > 0) {
+      if (options.per_type_queues) {
+        throw std::invalid_argument("partitioned endpoints can't have per-type queues");
+      }
+      auto queue_options = options;
+      queue_options.partitions = 0;
+      return std::make_unique<partitioned_transport<msg>>(
+          arena, name, partitions,
+          [&arena, max_messages, queue_options](const char *queue_name) {
+            return make_transport(arena, queue_name, max_messages, queue_options);
+          });
+    }
+    if (options.per_type_queues) {
+      auto queue_options = options;
+      queue_options.per_type_queues = false;
+      // Message queues would live outside the arena under names nobody knows to remove
+      if (kind == transport_kind::message_queue) {
+        queue_options.transport = transport_kind::mpmc_ring;
+      }
+      return std::make_unique<typed_transport<msg>>(
+          arena, name, [&arena, max_messages, queue_options](const char *queue_name) {
+            return make_transport(arena, queue_name, max_messages, queue_options);
+          });
+    }
+    switch (kind) {
+    case transport_kind::message_queue:
+      return std::make_unique<message_queue_transport<msg>>(arena, name, max_messages);
+    case transport_kind::spsc_ring:
+      return std::make_unique<ring_transport<spsc_ring<msg>>>(arena, name, max_messages,
+                                                              options.priorities);
+    case transport_kind::mpsc_ring:
+      return std::make_unique<ring_transport<mpsc_ring<msg>>>(arena, name, max_messages,
+                                                              options.priorities);
+    case transport_kind::mpmc_ring:
+      return std::make_unique<ring_transport<mpmc_ring<msg>>>(arena, name, max_messages,
+                                                              options.priorities);
+    }
+    throw std::invalid_argument("unknown transport");
+  }
+
+  arena &arena_;
+  endpoint_options options_;
+  std::unique_ptr<transport<msg>> transport_;
+  // Set if `transport_` keeps per-type queues
+  typed_transport<msg> *typed_;
+  // Set if `transport_` is partitioned
+  partitioned_transport<msg> *partitioned_;
+  // Messages sent with `sender::send_at()` that aren't due yet; see `timers()`
+  std::string timers_name_;
+  timer_wheel<msg> *timers_ = nullptr;
+  // Set if the endpoint conflates messages
+  conflation_table<msg> *conflated_;
+  // Set if the endpoint has credit limits
+  credit_pool *credits_;
+  watchers *watchers_;
+  // Partition of the next message without a key
+  std::size_t next_partition_ = 0;
+  // Types passed to the last `select()`
+  std::vector<std::size_t> selected_;
+  // See `signal_error()`
+  std::error_code signal_error_;
+
+  msg_vec *msgs_;
+};
+
+// What every envelope starts with, whatever the message type. Fields only some envelopes need
+// sit right in front of it, so that plain messages don't pay for them; `features` tells which
+// ones are there.
+struct envelope_header {
+  enum feature : std::uint8_t {
+    // Credits the envelope was sent with go back to the sender's pool once it's freed
+    credited = 1,
+    // Memory goes back to a slab pool rather than to the arena
+    pooled = 2,
+    // Sent with a region, which it keeps alive
+    regional = 4,
+    // A request made with `sender::call()`, or the reply to one
+    correlated = 8,
+  };
+
+  struct rpc_fields {
+    std::uint64_t correlation = 0;
+    // Name of the endpoint replies to a request go to
+    bip::offset_ptr<const char> reply_to;
+  };
+
+  // Bytes the fields of `features` take in front of the header
+  static constexpr std::size_t extras_size(std::uint8_t features) {
+    return (features & credited ? sizeof(bip::offset_ptr<credit_pool>) : 0) +
+           (features & pooled ? sizeof(bip::offset_ptr<slab_pool>) : 0) +
+           (features & regional ? sizeof(bip::offset_ptr<oink::region>) : 0) +
+           (features & correlated ? sizeof(rpc_fields) : 0);
+  }
+
+  credit_pool *credits() {
+    return features & credited ? field<bip::offset_ptr<credit_pool>>(credited)->get() : nullptr;
+  }
+
+  slab_pool *pool() {
+    return features & pooled ? field<bip::offset_ptr<slab_pool>>(pooled)->get() : nullptr;
+  }
+
+  oink::region *region() {
+    return features & regional ? field<bip::offset_ptr<oink::region>>(regional)->get() : nullptr;
+  }
+
+  rpc_fields *rpc() { return features & correlated ? field<rpc_fields>(correlated) : nullptr; }
+
+  // Sets up the fields of `with`. They're all added at once, as where each one goes depends on
+  // which others are there.
+  void extend(std::uint8_t with, credit_pool *credits, slab_pool *pool, oink::region *region) {
+    features = with;
+    if (with & credited) {
+      std::construct_at(field<bip::offset_ptr<credit_pool>>(credited), credits);
+    }
+    if (with & pooled) {
+      std::construct_at(field<bip::offset_ptr<slab_pool>>(pooled), pool);
+    }
+    if (with & regional) {
+      std::construct_at(field<bip::offset_ptr<oink::region>>(regional), region);
+    }
+    if (with & correlated) {
+      std::construct_at(field<rpc_fields>(correlated));
+    }
+  }
+
+  std::uint8_t features = 0;
+
+private:
+  // Fields go outwards from the header in the order of their features
+  template <typename T> T *field(feature f) {
+    return reinterpret_cast<T *>(reinterpret_cast<char *>(this) -
+                                 extras_size(features & (f | (f - 1))));
+  }
+};
+
+template <message M> struct message_envelope : envelope_header {
+  template <typename... Args>
+  message_envelope(Args &&...args) : message(std::forward<Args>(args)...), counter(0) {}
+
+  operator M &() { return message; }
+
+  // Where the envelope starts in its block of memory, past the fields of `features`
+  static constexpr std::size_t front(std::uint8_t features) {
+    constexpr auto align = alignof(message_envelope);
+    return (extras_size(features) + align - 1) / align * align;
+  }
+
+  // Size of the block of memory an envelope with `features` takes
+  static constexpr std::size_t size(std::uint8_t features) {
+    return front(features) + sizeof(message_envelope);
+  }
+
+  static message_envelope *in(void *block, std::uint8_t features) {
+    return reinterpret_cast<message_envelope *>(static_cast<char *>(block) + front(features));
+  }
+
+  void *block() { return reinterpret_cast<char *>(this) - front(features); }
+
+  template <message M_> friend struct message_envelope_receipt;
+
+private:
+  M message;
+  std::atomic<std::size_t> counter;
+};
+
+template <message M> struct message_envelope_receipt {
+
+  M *operator->() { return &envelope->message; }
+
+  operator M &() { return envelope->message; }
+
+  ~message_envelope_receipt() {
+    if (envelope != nullptr) {
+      std::size_t counter = envelope->counter.fetch_sub(1) - 1;
+      if (counter == 0) {
+        auto credits = envelope->credits();
+        auto pool = envelope->pool();
+        auto region = envelope->region();
+        auto block = envelope->block();
+        std::destroy_at(envelope);
+        if (region != nullptr && region->contains(block)) {
+          // Goes back along with the region
+        } else if (pool != nullptr) {
+          magazine_cache::deallocate(arena_, *pool, block);
+        } else {
+          arena_.get().get_segment_manager()->deallocate(block);
+        }
+        if (credits != nullptr) {
+          credits->release(arena_, sizeof(message_envelope<M>), 1);
+        }
+        if (region != nullptr) {
+          region->release();
+        }
+      }
+    }
+  }
+
+  friend struct sender;
+  friend struct receiver;
+  friend struct publisher;
+  friend struct reply_channel;
+  friend struct envelope_releasers;
+
+  message_envelope_receipt(const message_envelope_receipt &other)
+      : envelope(other.envelope), arena_(other.arena_) {
+    other.envelope->counter.fetch_add(1);
+  }
+
+  message_envelope_receipt(message_envelope_receipt &&other) noexcept
+      : envelope(other.envelope), arena_(other.arena_) {
+    other.envelope = nullptr;
+  }
+
+  message_envelope_receipt &operator=(const message_envelope_receipt &other) {
+    if (this == &other)
+      return *this;
+    envelope = other.envelope;
+    arena_ = other.arena_;
+    other.envelope->counter.fetch_add(1);
+    return *this;
+  }
+
+  message_envelope_receipt &operator=(message_envelope_receipt &&other) noexcept {
+    if (this == &other)
+      return *this;
+    envelope = other.envelope;
+    arena_ = other.arena_;
+    other.envelope = nullptr;
+    return *this;
+  }
+
+private:
+  message_envelope_receipt(message_envelope<M> *envelope, arena &arena, bool acquire = true)
+      : envelope(envelope), arena_(arena) {
+    if (acquire) {
+      envelope->counter.fetch_add(2);
+    }
+  }
+
+  std::ptrdiff_t offset() {
+    return reinterpret_cast<char *>(envelope) -
+           reinterpret_cast<char *>(arena_.get().get_address());
+  }
+
+  void retain() { envelope = nullptr; }
+
+  // Drops the shares taken for the receiving side of `queues` queues the message never made
+  // it into
+  void unpublish(std::size_t queues = 1) { envelope->counter.fetch_sub(queues); }
+
+  // Takes shares for `queues` more queues the message is about to be placed into
+  void share(std::size_t queues) { envelope->counter.fetch_add(queues); }
+
+  message_envelope<M> *envelope;
+  std::reference_wrapper<arena> arena_;
+};
+
+// Frees envelopes known only by their queue entry, for messages dropped without anyone
+// handling them. Only types this process has sent, received or expected before are known.
+struct envelope_releasers {
+  template <message M> static void add() {
+    static const bool added = [] {
+      auto &table = releasers();
+      std::lock_guard lock(table.mutex);
+      table.release.emplace(message_tag<M>(), &release<M>);
+      return true;
+    }();
+    (void)added;
+  }
+
+  // Drops the queue's share of the entry's envelope. Returns `false`, leaving it alone, for
+  // entries of unknown types and entries without an envelope.
+  static bool release(arena &arena, const endpoint::msg &m) {
+    if (m.offset <= 0) {
+      return false;
+    }
+    void (*release)(oink::arena &, std::ptrdiff_t);
+    {
+      auto &table = releasers();
+      std::lock_guard lock(table.mutex);
+      auto it = table.release.find(m.hash);
+      if (it == table.release.end()) {
+        return false;
+      }
+      release = it->second;
+    }
+    release(arena, m.offset);
+    return true;
+  }
+
+private:
+  struct table {
+    std::mutex mutex;
+    std::unordered_map<std::size_t, void (*)(arena &, std::ptrdiff_t)> release;
+  };
+
+  static table &releasers() {
+    static table table;
+    return table;
+  }
+
+  template <message M> static void release(arena &arena, std::ptrdiff_t offset) {
+    message_envelope_receipt<M>(
+        reinterpret_cast<message_envelope<M> *>(static_cast<char *>(arena.get_address()) + offset),
+        arena, false);
+  }
+};
+
+// Endpoint the replies to one caller's requests arrive at, named `__reply.<n>`. Its thread
+// hands every reply to the call that waits for it, by correlation id.
+//
+// Receivers replying to the channel attach to it (see `attach()`); the channel and everything
+// still queued in it are freed once the caller and all of them have let go.
+struct reply_channel : endpoint {
+  static constexpr std::size_t max_replies = 1024;
+  // Any number of receivers may reply at once
+  static constexpr endpoint_options options{.transport = transport_kind::mpsc_ring};
+
+  // Kept in the arena under `<name>.link`, guarded by the arena's `directory`
+  struct link {
+    // The caller and every receiver attached to the channel
+    std::size_t refs = 1;
+    // Set once the caller is gone; replies are no longer read
+    std::atomic<bool> closed = false;
+  };
+
+  explicit reply_channel(arena &arena) : reply_channel(arena, next_name(arena)) {}
+
+  reply_channel(const reply_channel &) = delete;
+  reply_channel &operator=(const reply_channel &) = delete;
+
+  ~reply_channel() {
+    stop_ = true;
+    transport_->wake();
+    thread_.join();
+    link_->closed.store(true, std::memory_order_release);
+    detach(arena_, name_, link_, *transport_);
+  }
+
+  // Name of the endpoint, as stored in the arena
+  const char *name() const { return name_; }
+
+  // Returns a new correlation id along with the future its reply will satisfy
+  template <message M> std::pair<std::uint64_t, std::future<message_envelope_receipt<M>>> expect() {
+    envelope_releasers::add<M>();
+    auto promise = std::make_shared<std::promise<message_envelope_receipt<M>>>();
+    auto future = promise->get_future();
+    std::lock_guard lock(mutex_);
+    auto id = next_id_++;
+    pending_.emplace(id, [this, promise](const msg &m) {
+      if (m.hash != message_tag<M>()) {
+        envelope_releasers::release(arena_, m);
+        promise->set_exception(std::make_exception_ptr(
+            std::runtime_error(std::string("unexpected reply ") + std::to_string(m.hash))));
+        return;
+      }
+      promise->set_value(message_envelope_receipt<M>(
+          reinterpret_cast<message_envelope<M> *>(static_cast<char *>(arena_.get_address()) +
+                                                  m.offset),
+          arena_, false));
+    });
+    return {id, std::move(future)};
+  }
+
+  // Drops an expectation whose request was never sent
+  void forget(std::uint64_t id) {
+    std::lock_guard lock(mutex_);
+    pending_.erase(id);
+  }
+
+  // Takes a reference to the channel named `name` for replying to it; null if it's gone
+  static link *attach(arena &arena, const char *name) {
+    auto &directory = directory_of(arena);
+    bip::scoped_lock<bip::interprocess_mutex> lock(directory.mutex);
+    auto link = arena.find<reply_channel::link>((std::string(name) + ".link").c_str());
+    if (!link || (*link)->closed.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    (*link)->refs++;
+    return *link;
+  }
+
+  // Lets go of a reference to the channel, given its `queue`. The last one frees the channel,
+  // releasing the replies that are still queued.
+  static void detach(arena &arena, const char *name, link *link, transport<msg> &queue) {
+    auto &directory = directory_of(arena);
+    bip::scoped_lock<bip::interprocess_mutex> lock(directory.mutex);
+    if (--link->refs > 0) {
+      return;
+    }
+    msg m;
+    while (queue.try_pop(m)) {
+      envelope_releasers::release(arena, m);
+    }
+    std::string prefix(name);
+    auto *segment_manager = arena.get_segment_manager();
+    ring_transport<mpsc_ring<msg>>::destroy(arena, prefix.c_str());
+    segment_manager->destroy<transport_layout>((prefix + ".transport").c_str());
+    segment_manager->destroy<watchers>((prefix + ".watchers").c_str());
+    segment_manager->destroy<reply_channel::link>((prefix + ".link").c_str());
+    segment_manager->destroy<char>((prefix + ".name").c_str());
+  }
+
+private:
+  // Guards the channels' links; lives in the arena under `__reply_channels`
+  struct directory {
+    bip::interprocess_mutex mutex;
+    std::uint64_t next = 0;
+  };
+
+  reply_channel(arena &arena, const std::string &name)
+      : endpoint(arena, name.c_str(), max_replies, options),
+        name_(arena.get_segment_manager()->find_or_construct<char>(
+            (name + ".name").c_str())[name.size() + 1]('\0')),
+        link_(arena.get_segment_manager()->find_or_construct<link>((name + ".link").c_str())()) {
+    std::ranges::copy(name, name_);
+    thread_ = std::thread([this] { run(); });
+  }
+
+  static directory &directory_of(arena &arena) {
+    return *arena.get_segment_manager()->find_or_construct<directory>("__reply_channels")();
+  }
+
+  static std::string next_name(arena &arena) {
+    auto &directory = directory_of(arena);
+    bip::scoped_lock<bip::interprocess_mutex> lock(directory.mutex);
+    return "__reply." + std::to_string(directory.next++);
+  }
+
+  void run() {
+    auto &queue = static_cast<ring_transport<mpsc_ring<msg>> &>(*transport_);
+    msg m;
+    while (true) {
+      // Read first, so that stopping right after the check still wakes the pop up
+      auto wakeups = queue.wakeups();
+      if (stop_) {
+        break;
+      }
+      if (queue.pop_many_until(&m, 1, transport<msg>::clock::time_point::max(), wakeups) == 0) {
+        continue;
+      }
+      signal_dequeued();
+      auto rpc =
+          reinterpret_cast<envelope_header *>(static_cast<char *>(arena_.get_address()) + m.offset)
+              ->rpc();
+      auto correlation = rpc != nullptr ? rpc->correlation : 0;
+      std::function<void(const msg &)> complete;
+      {
+        std::lock_guard lock(mutex_);
+        if (auto node = pending_.extract(correlation)) {
+          complete = std::move(node.mapped());
+        }
+      }
+      if (complete) {
+        complete(m);
+      } else {
+        // Nobody waits for it (any more)
+        envelope_releasers::release(arena_, m);
+      }
+    }
+  }
+
+  char *name_;
+  link *link_;
+  std::mutex mutex_;
+  std::unordered_map<std::uint64_t, std::function<void(const msg &)>> pending_;
+  std::uint64_t next_id_ = 1;
+  std::atomic<bool> stop_ = false;
+  std::thread thread_;
+};
+
+enum class send_status {
+  queued,
+  // No room in the queue (by the deadline, if any)
+  queue_full,
+  // Out of credits (by the deadline, if any)
+  no_credit,
+  // Not enough free memory in the arena for the message
+  arena_full,
+};
+
+// Outcome of a send that may not queue the message. Whatever was allocated for a message that
+// wasn't queued has been released already.
+template <message M> struct send_result {
+  send_status status;
+  // Only set if the message was queued
+  std::optional<message_envelope_receipt<M>> receipt = std::nullopt;
+
+  explicit operator bool() const { return status == send_status::queued; }
+};
+
+// A process's reference to a `region`, made with `sender::make_region()`
+struct region_handle {
+  region_handle(region_handle &&other) noexcept : region_(std::exchange(other.region_, nullptr)) {}
+
+  region_handle &operator=(region_handle &&other) noexcept {
+    if (this != &other) {
+      reset();
+      region_ = std::exchange(other.region_, nullptr);
+    }
+    return *this;
+  }
+
+  ~region_handle() { reset(); }
+
+  // Allocator taking memory from the region, for the payloads of messages sent with it
+  template <typename T> allocator<T> get_allocator() const {
+    return allocator<T>(region_->get_segment_manager(), region_);
+  }
+
+  std::size_t capacity() const { return region_->capacity(); }
+  std::size_t used() const { return region_->used(); }
+
+  // Lets go of the region; it's freed once the messages sent with it are
+  void reset() {
+    if (region_ != nullptr) {
+      std::exchange(region_, nullptr)->release();
+    }
+  }
+
+private:
+  friend struct sender;
+
+  explicit region_handle(oink::region *region) : region_(region) {}
+
+  oink::region *region_;
+};
+
+struct sender : endpoint {
+  using endpoint::endpoint;
+
+  template <message M, typename... Args> message_envelope_receipt<M> send(Args &&...args) {
+    return send<M>(priority{}, std::forward<Args>(args)...);
+  }
+
+  template <message M, typename... Args>
+  message_envelope_receipt<M> send(priority priority, Args &&...args) {
+    return send<M>(priority, expiry{}, std::forward<Args>(args)...);
+  }
+
+  // Receivers drop the message, rather than handle it, once it's past its expiry
+  template <message M, typename... Args>
+  message_envelope_receipt<M> send(expiry expiry, Args &&...args) {
+    return send<M>(priority{}, expiry, std::forward<Args>(args)...);
+  }
+
+  template <message M, typename... Args>
+  message_envelope_receipt<M> send(priority priority, expiry expiry, Args &&...args) {
+    auto receipt = make_envelope<M>(std::forward<Args>(args)...);
+    push(receipt, priority, expiry);
+    return receipt;
+  }
+
+  // Sets aside `capacity` bytes of the arena for messages sent with `send(region_handle &, ...)`
+  // and their payloads (allocated with `region.get_allocator()`)
+  region_handle make_region(std::size_t capacity) {
+    return region_handle(region::create(arena_.get_segment_manager(), capacity));
+  }
+
+  // Sends a message whose envelope is bump-allocated from `region`, or from the arena once the
+  // region is full. The region is freed in one go after its handle and all messages sent with
+  // it are.
+  template <message M, typename... Args>
+  message_envelope_receipt<M> send(region_handle &region, Args &&...args) {
+    auto receipt = make_envelope_in<M>(*region.region_, std::forward<Args>(args)...);
+    push(receipt, priority{});
+    return receipt;
+  }
+
+  // Delivers the message at `time` (right away if it's past). Until then, the entry waits in
+  // the endpoint's timer wheel in the arena and receivers move it over to the queue once
+  // it's due, so no thread waits for it and it takes no room in the queue.
+  //
+  // Receivers waiting with an `executor` wake up for it on their own; those polled through
+  // a `native_handle()` need to be tried again by `receiver::next_wake()`.
+  template <message M, typename... Args>
+  message_envelope_receipt<M> send_at(transport<msg>::clock::time_point time, Args &&...args) {
+    auto receipt = make_envelope<M>(std::forward<Args>(args)...);
+    auto m = entry<M>(receipt, receipt.offset(), 0);
+    try {
+      if (timers(true)->schedule(m, time)) {
+        // Receivers may be parked until something later
+        transport_->wake();
+        signal_queued();
+      }
+    } catch (...) {
+      receipt.unpublish();
+      throw;
+    }
+    return receipt;
+  }
+
+  template <message M, typename Rep, typename Period, typename... Args>
+  message_envelope_receipt<M> send_after(std::chrono::duration<Rep, Period> delay,
+                                         Args &&...args) {
+    return send_at<M>(transport<msg>::clock::now() +
+                          std::chrono::duration_cast<transport<msg>::clock::duration>(delay),
+                      std::forward<Args>(args)...);
+  }
+
+  // Sends a request of type `Req`, to be answered with a `Resp` by a receiver calling
+  // `receiver::reply()`. The returned future is satisfied with the reply itself.
+  //
+  // Replies go to an endpoint of this sender's own, created with the first call.
+  template <message Req, message Resp, typename... Args>
+  std::future<message_envelope_receipt<Resp>> call(Args &&...args) {
+    return call<Req, Resp>(priority{}, std::forward<Args>(args)...);
+  }
+
+  template <message Req, message Resp, typename... Args>
+  std::future<message_envelope_receipt<Resp>> call(priority priority, Args &&...args) {
+    auto request = make_envelope_as<Req>(envelope_header::correlated, nullptr, std::forward<Args>(args)...);
+    if (!replies_) {
+      replies_ = std::make_unique<reply_channel>(arena_);
+    }
+    auto [id, future] = replies_->expect<Resp>();
+    request.envelope->rpc()->correlation = id;
+    request.envelope->rpc()->reply_to = replies_->name();
+    try {
+      push(request, priority);
+    } catch (...) {
+      replies_->forget(id);
+      throw;
+    }
+    return std::move(future);
+  }
+
+  // Sends without ever blocking; see `send_result` for what happens if the message can't be
+  // queued
+  template <message M, typename... Args> send_result<M> try_send(Args &&...args) {
+    return try_send<M>(priority{}, std::forward<Args>(args)...);
+  }
+
+  template <message M, typename... Args>
+  send_result<M> try_send(priority priority, Args &&...args) {
+    return send_before<M>(priority, std::nullopt, std::forward<Args>(args)...);
+  }
+
+  // Waits for room in the queue until the deadline at most
+  template <message M, typename... Args>
+  send_result<M> send_until(transport<msg>::clock::time_point deadline, Args &&...args) {
+    return send_until<M>(deadline, priority{}, std::forward<Args>(args)...);
+  }
+
+  template <message M, typename... Args>
+  send_result<M> send_until(transport<msg>::clock::time_point deadline, priority priority,
+                            Args &&...args) {
+    return send_before<M>(priority, deadline, std::forward<Args>(args)...);
+  }
+
+  // Awaitable returned by `send_async()`. Holds on to the message's constructor arguments
+  // until there are credits for it.
+  template <message M, typename... Args> struct send_operation : pending_operation {
+    send_operation(sender &sender, priority priority, std::tuple<Args...> args)
+        : sender_(sender), priority_(priority), args_(std::move(args)) {}
+
+    send_operation(const send_operation &) = delete;
+    send_operation &operator=(const send_operation &) = delete;
+
+    ~send_operation() {
+      // Only a message that never made it into the queue still holds the queue's share
+      if (state_ == state::published && receipt_.has_value() && receipt_->envelope != nullptr) {
+        receipt_->unpublish();
+      }
+    }
+
+    bool await_ready() { return try_complete(); }
+
+    template <typename Promise> void await_suspend(std::coroutine_handle<Promise> handle) {
+      auto &executor = handle.promise().get_executor();
+      if (state_ == state::unconstructed) {
+        // Credits come back as messages are freed; room in the queue comes after that
+        executor.suspend(handle, *this,
+                         {&sender_.credits_->watchers(), &sender_.watchers_->writable});
+      } else {
+        executor.suspend(handle, *this, sender_.watchers_->writable);
+      }
+    }
+
+    message_envelope_receipt<M> await_resume() {
+      if (state_ == state::failed) {
+        std::rethrow_exception(error_);
+      }
+      state_ = state::resumed;
+      return std::move(*receipt_);
+    }
+
+    bool try_complete() override {
+      if (state_ == state::unconstructed) {
+        auto credits = sender_.credits_;
+        if (credits != nullptr && !credits->try_acquire(sizeof(message_envelope<M>), 1)) {
+          return false;
+        }
+        try {
+          receipt_.emplace(std::apply(
+              [this](auto &...args) {
+                return sender_.make_credited_envelope<M>(0, nullptr, std::move(args)...);
+              },
+              args_));
+        } catch (...) {
+          // Handed over to the task once it resumes
+          error_ = std::current_exception();
+          state_ = state::failed;
+          return true;
+        }
+        state_ = state::published;
+      }
+      if (state_ != state::published) {
+        return true;
+      }
+      auto m = sender_.entry<M>(*receipt_, receipt_->offset(), priority_.value);
+      if (!sender_.enqueue<M>(*receipt_, m, [this](const msg &entry) {
+            return sender_.transport_->try_push(entry, priority_.value);
+          })) {
+        return false;
+      }
+      state_ = state::queued;
+      sender_.signal_queued();
+      return true;
+    }
+
+  private:
+    enum class state {
+      // Waiting for credits
+      unconstructed,
+      // The receipt holds a share for the queue, which the message isn't in yet
+      published,
+      queued,
+      // The message couldn't be constructed
+      failed,
+      // The receipt was handed over to the task
+      resumed,
+    };
+
+    sender &sender_;
+    priority priority_;
+    std::tuple<Args...> args_;
+    std::optional<message_envelope_receipt<M>> receipt_;
+    std::exception_ptr error_;
+    state state_ = state::unconstructed;
+  };
+
+  // Sends from within a `task`: while the queue is full, or the endpoint is out of credits,
+  // the task is suspended until a receiver makes room or frees a message. The arguments are
+  // kept until the message is constructed, which happens as soon as there are credits for it.
+  template <message M, typename... Args>
+  send_operation<M, std::decay_t<Args>...> send_async(Args &&...args) {
+    return send_async<M>(priority{}, std::forward<Args>(args)...);
+  }
+
+  template <message M, typename... Args>
+  send_operation<M, std::decay_t<Args>...> send_async(priority priority, Args &&...args) {
+    return send_operation<M, std::decay_t<Args>...>(
+        *this, priority, std::tuple<std::decay_t<Args>...>(std::forward<Args>(args)...));
+  }
+
+  // Sends a message constructed from every element of `range`.
+  //
+  // All envelopes are allocated from the arena in one go and published to the transport at
+  // once, so the whole batch costs one allocation lock and (for rings) one tail update and
+  // one wakeup.
+  template <message M, std::ranges::sized_range R>
+  std::vector<message_envelope_receipt<M>> send_batch(R &&range, priority priority = {}) {
+    std::size_t count = std::ranges::size(range);
+    std::vector<message_envelope_receipt<M>> receipts;
+    std::vector<msg> msgs;
+    receipts.reserve(count);
+    msgs.reserve(count);
+    if (count == 0) {
+      return receipts;
+    }
+
+    // Credits for the whole batch are taken at once
+    if (credits_ != nullptr) {
+      credits_->acquire_until(sizeof(message_envelope<M>) * count, count,
+                              notifier::clock::time_point::max());
+    }
+    // Slab pools hand out blocks without a lock anyway
+    auto features = features_of<M>();
+    auto pool = slab<M>(features);
+    bip::managed_shared_memory::segment_manager::multiallocation_chain chain;
+    try {
+      if (pool == nullptr) {
+        arena_.get_segment_manager()->allocate_many(message_envelope<M>::size(features), count,
+                                                    chain);
+      }
+    } catch (...) {
+      return_credits<M>(count);
+      throw;
+    }
+    try {
+      for (auto &&args : range) {
+        auto block = pool != nullptr ? magazine_cache::allocate(arena_, *pool)
+                                     : bip::ipcdetail::to_raw_pointer(chain.pop_front());
+        if (block == nullptr) {
+          throw bip::bad_alloc();
+        }
+        auto envelope = message_envelope<M>::in(block, features);
+        try {
+          std::construct_at(envelope, std::forward<decltype(args)>(args));
+        } catch (...) {
+          deallocate_envelope(envelope, features);
+          throw;
+        }
+        adopt(envelope, features);
+        receipts.push_back(message_envelope_receipt(envelope, arena_));
+        msgs.push_back(entry<M>(receipts.back(), receipts.back().offset(), priority.value));
+      }
+    } catch (...) {
+      arena_.get_segment_manager()->deallocate_many(chain);
+      // Envelopes we've constructed give their credits back once freed
+      return_credits<M>(count - receipts.size());
+      // Nothing was published, so drop the transport's share of what we've constructed
+      for (auto &receipt : receipts) {
+        receipt.unpublish();
+      }
+      throw;
+    }
+
+    transport_->push_many(msgs.data(), msgs.size(), priority.value);
+    signal_queued();
+    return receipts;
+  }
+
+  // Collects messages of different types and sends them at once with `send()`. Messages
+  // that were added but not sent are released when the batch is destroyed.
+  struct batch {
+    explicit batch(sender &sender, priority priority = {})
+        : sender_(sender), priority_(priority) {}
+
+    batch(const batch &) = delete;
+    batch &operator=(const batch &) = delete;
+
+    ~batch() {
+      for (auto &entry : entries_) {
+        entry.release(sender_.arena_, entry.m.offset);
+      }
+    }
+
+    template <message M, typename... Args> message_envelope_receipt<M> add(Args &&...args) {
+      auto receipt = sender_.make_envelope<M>(std::forward<Args>(args)...);
+      entries_.push_back(entry{.m = sender_.entry<M>(receipt, receipt.offset(), priority_.value),
+                               .release = &release<M>});
+      return receipt;
+    }
+
+    std::size_t size() const { return entries_.size(); }
+
+    void send() {
+      std::vector<msg> msgs;
+      msgs.reserve(entries_.size());
+      for (auto &entry : entries_) {
+        msgs.push_back(entry.m);
+      }
+      sender_.transport_->push_many(msgs.data(), msgs.size(), priority_.value);
+      sender_.signal_queued();
+      entries_.clear();
+    }
+
+  private:
+    struct entry {
+      msg m;
+      void (*release)(arena &, std::ptrdiff_t);
+    };
+
+    template <message M> static void release(arena &arena, std::ptrdiff_t offset) {
+      message_envelope_receipt<M>(
+          reinterpret_cast<message_envelope<M> *>(static_cast<char *>(arena.get_address()) +
+                                                  offset),
+          arena, false);
+    }
+
+    sender &sender_;
+    priority priority_;
+    std::vector<entry> entries_;
+  };
+
+  batch make_batch(priority priority = {}) { return batch(*this, priority); }
+
+private:
+  friend struct receiver;
+  friend struct publisher;
+
+  // Waits for credits as long as it takes
+  template <message M, typename... Args>
+  message_envelope_receipt<M> make_envelope(Args &&...args) {
+    return make_envelope_as<M>(0, nullptr, std::forward<Args>(args)...);
+  }
+
+  // Same, for an envelope that also has the fields of `extra` features, and holds on to
+  // `region` if there is one
+  template <message M, typename... Args>
+  message_envelope_receipt<M> make_envelope_as(std::uint8_t extra, region *region,
+                                               Args &&...args) {
+    if (credits_ != nullptr) {
+      credits_->acquire_until(sizeof(message_envelope<M>), 1, notifier::clock::time_point::max());
+    }
+    return make_credited_envelope<M>(extra, region, std::forward<Args>(args)...);
+  }
+
+  // For a message whose credits were taken already; gives them back if it can't be made
+  template <message M, typename... Args>
+  message_envelope_receipt<M> make_credited_envelope(std::uint8_t extra, region *region,
+                                                     Args &&...args) {
+    auto features =
+        features_of<M>(region != nullptr ? extra | envelope_header::regional : extra);
+    auto envelope = allocate_envelope<M>(features);
+    try {
+      if (envelope == nullptr) {
+        throw bip::bad_alloc();
+      }
+      try {
+        std::construct_at(envelope, std::forward<Args>(args)...);
+      } catch (...) {
+        deallocate_envelope(envelope, features);
+        throw;
+      }
+    } catch (...) {
+      return_credits<M>(1);
+      throw;
+    }
+    adopt(envelope, features, region);
+    return message_envelope_receipt(envelope, arena_);
+  }
+
+  // Features envelopes of type `M` this sender makes have, on top of `extra`
+  template <message M> std::uint8_t features_of(std::uint8_t extra = 0) const {
+    if (credits_ != nullptr) {
+      extra |= envelope_header::credited;
+    }
+    if (options_.slab_pools && alignof(message_envelope<M>) <= slab_pool::alignment) {
+      extra |= envelope_header::pooled;
+    }
+    return extra;
+  }
+
+  // Slab pool envelopes of type `M` with `features` come from, if they're pooled
+  template <message M> slab_pool *slab(std::uint8_t features) {
+    if (!(features & envelope_header::pooled)) {
+      return nullptr;
+    }
+    auto size = slab_pool::size_class(message_envelope<M>::size(features));
+    auto &pool = slabs_[size];
+    if (pool == nullptr) {
+      pool = arena_.get_segment_manager()->find_or_construct<slab_pool>(
+          ("__slab." + std::to_string(size)).c_str())(arena_.get_segment_manager(), size);
+    }
+    return pool;
+  }
+
+  // Memory for an envelope with `features`; null if the arena is full
+  template <message M> message_envelope<M> *allocate_envelope(std::uint8_t features) {
+    void *block = nullptr;
+    if (auto pool = slab<M>(features)) {
+      block = magazine_cache::allocate(arena_, *pool);
+    } else {
+      block = arena_.get_segment_manager()->allocate(message_envelope<M>::size(features),
+                                                     std::nothrow);
+    }
+    return block != nullptr ? message_envelope<M>::in(block, features) : nullptr;
+  }
+
+  // For envelopes that were never adopted, whose header doesn't know their features yet
+  template <message M>
+  void deallocate_envelope(message_envelope<M> *envelope, std::uint8_t features) {
+    void *block = reinterpret_cast<char *>(envelope) - message_envelope<M>::front(features);
+    if (auto pool = slab<M>(features)) {
+      magazine_cache::deallocate(arena_, *pool, block);
+    } else {
+      arena_.get_segment_manager()->deallocate(block);
+    }
+  }
+
+  template <message M, typename... Args>
+  message_envelope_receipt<M> make_envelope_in(region &region, Args &&...args) {
+    std::uint8_t features = envelope_header::regional;
+    if (credits_ != nullptr) {
+      features |= envelope_header::credited;
+    }
+    auto block =
+        region.allocate(message_envelope<M>::size(features), alignof(message_envelope<M>));
+    if (block == nullptr) {
+      // Payloads may still come from the region, so the message holds on to it all the same
+      return make_envelope_as<M>(0, &region, std::forward<Args>(args)...);
+    }
+    auto envelope = message_envelope<M>::in(block, features);
+    if (credits_ != nullptr) {
+      credits_->acquire_until(sizeof(message_envelope<M>), 1, notifier::clock::time_point::max());
+    }
+    try {
+      std::construct_at(envelope, std::forward<Args>(args)...);
+    } catch (...) {
+      return_credits<M>(1);
+      throw;
+    }
+    adopt(envelope, features, &region);
+    return message_envelope_receipt(envelope, arena_);
+  }
+
+  // Records where the envelope's credits and memory go back to once it's freed
+  template <message M>
+  void adopt(message_envelope<M> *envelope, std::uint8_t features, region *region = nullptr) {
+    envelope_releasers::add<M>();
+    if (features & envelope_header::regional) {
+      region->retain();
+    }
+    envelope->extend(features, credits_, slab<M>(features), region);
+  }
+
+  template <message M> void return_credits(std::size_t count) {
+    if (credits_ != nullptr) {
+      credits_->release(arena_, sizeof(message_envelope<M>) * count, count);
+    }
+  }
+
+  template <message M>
+  void push(message_envelope_receipt<M> &receipt, priority priority, expiry expiry = {}) {
+    auto m = entry<M>(receipt, receipt.offset(), priority.value);
+    m.expires = expiry.at.time_since_epoch().count();
+    try {
+      enqueue<M>(receipt, m, [&](const msg &entry) {
+        transport_->push(entry, priority.value);
+        return true;
+      });
+    } catch (...) {
+      receipt.unpublish();
+      throw;
+    }
+    signal_queued();
+  }
+
+  // Queues the entry with `queue`, which returns whether it did. On conflating endpoints, the
+  // message may replace a queued one with the same key instead; the replaced one is released.
+  template <message M, typename Queue> bool enqueue(const M &message, const msg &m, Queue &&queue) {
+    if constexpr (requires { message.conflation_key(); }) {
+      if (conflated_ != nullptr) {
+        auto key = message.conflation_key();
+        if (auto index = conflated_->find(m.hash, std::hash<decltype(key)>{}(key))) {
+          auto result =
+              conflated_->offer(*index, m, [&] { return queue(conflated_entry(m, *index)); });
+          if (result.superseded) {
+            // Drops the share the superseded message's queue entry had
+            message_envelope_receipt<M>(
+                reinterpret_cast<message_envelope<M> *>(static_cast<char *>(arena_.get_address()) +
+                                                        result.superseded->offset),
+                arena_, false);
+          }
+          return result.queued;
+        }
+      }
+    }
+    return queue(m);
+  }
+
+  // Queues without blocking if there's no deadline
+  template <message M, typename... Args>
+  send_result<M> send_before(priority priority,
+                             std::optional<transport<msg>::clock::time_point> deadline,
+                             Args &&...args) {
+    if (credits_ != nullptr) {
+      constexpr auto bytes = sizeof(message_envelope<M>);
+      if (!(deadline.has_value() ? credits_->acquire_until(bytes, 1, *deadline)
+                                 : credits_->try_acquire(bytes, 1))) {
+        return {.status = send_status::no_credit};
+      }
+    }
+    auto features = features_of<M>();
+    auto envelope = allocate_envelope<M>(features);
+    if (envelope == nullptr) {
+      return_credits<M>(1);
+      return {.status = send_status::arena_full};
+    }
+    try {
+      std::construct_at(envelope, std::forward<Args>(args)...);
+    } catch (const bip::bad_alloc &) {
+      // Message's own arena allocations didn't fit
+      deallocate_envelope(envelope, features);
+      return_credits<M>(1);
+      return {.status = send_status::arena_full};
+    } catch (...) {
+      deallocate_envelope(envelope, features);
+      return_credits<M>(1);
+      throw;
+    }
+    adopt(envelope, features);
+    message_envelope_receipt<M> receipt = message_envelope_receipt(envelope, arena_);
+    auto m = entry<M>(receipt, receipt.offset(), priority.value);
+    bool queued = enqueue<M>(receipt, m, [&](const msg &entry) {
+      return deadline.has_value() ? transport_->push_until(entry, priority.value, *deadline)
+                                  : transport_->try_push(entry, priority.value);
+    });
+    if (!queued) {
+      // Our `receipt` is the only one left and frees the envelope
+      receipt.unpublish();
+      return {.status = send_status::queue_full};
+    }
+    signal_queued();
+    return {.status = send_status::queued, .receipt = std::move(receipt)};
+  }
+
+  std::unique_ptr<reply_channel> replies_;
+  // Slab pools used so far, by size class
+  std::unordered_map<std::size_t, slab_pool *> slabs_;
+};
+
+// Messages rejected by the visitor stay with the receiver that got them: they are kept in a
+// local deferred list and offered again (ahead of the queue) once their retry delay passes.
+struct receiver : endpoint {
+  receiver(arena &arena, const char *mq_segment_name, size_t mq_max_messages,
+           endpoint_options options = {})
+      : endpoint(arena, mq_segment_name, mq_max_messages, options) {
+    // Receivers of a partitioned endpoint share the partitions from the start
+    if (partitioned_ != nullptr) {
+      partitioned_->consume();
+    }
+  }
+
+  friend struct receiver_pool;
+
+  receiver(const receiver &) = delete;
+  receiver &operator=(const receiver &) = delete;
+
+  // Hands deferred messages back to the queue so that they can be picked up by other
+  // receivers. Messages that don't fit into it are released.
+  ~receiver() {
+    if (poller_ != nullptr) {
+      watchers_->pollers.remove(*poller_, poller_id_);
+    }
+    for (auto &[name, replier] : repliers_) {
+      detach(name, replier);
+    }
+    bool queued = false;
+    for (auto &d : deferred_) {
+      if (transport_->try_push(d.m, d.m.priority)) {
+        queued = true;
+      } else {
+        envelope_releasers::release(arena_, d.m);
+      }
+    }
+    if (queued) {
+      signal_queued();
+    }
+  }
+
+  struct unknown_message : public std::exception {
+    explicit unknown_message(std::size_t hash)
+        : hash(hash), message(std::string("unknown message ") + std::to_string(hash)) {}
+
+    const char *what() const noexcept override { return message.c_str(); }
+
+    std::size_t message_hash() const { return hash; }
+
+  private:
+    std::size_t hash;
+    std::string message;
+  };
+
+  using clock = transport<msg>::clock;
+
+  const wait_stats &get_wait_stats() const { return stats_; }
+
+  // Waits up to 500ms for a message
+  template <message... Msg> bool receive(auto visitor) {
+    return receive_for<Msg...>(visitor, std::chrono::milliseconds(500));
+  }
+
+  template <message... Msg, typename Rep, typename Period>
+  bool receive_for(auto visitor, std::chrono::duration<Rep, Period> timeout) {
+    auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(timeout);
+    return receive_until<Msg...>(visitor, deadline);
+  }
+
+  // Waits until the deadline for a message; `clock::time_point::max()` waits indefinitely
+  template <message... Msg> bool receive_until(auto visitor, clock::time_point deadline) {
+    select<Msg...>();
+    msg m;
+    while (next(&m, 1, deadline) == 1) {
+      signal_dequeued();
+      if (!drop_expired<Msg...>(m, clock::now())) {
+        return handle_received<Msg...>(m, visitor);
+      }
+    }
+    return false;
+  }
+
+  // Never blocks. An empty queue is detected without taking any lock.
+  template <message... Msg> bool try_receive(auto visitor) {
+    select<Msg...>();
+    msg m;
+    do {
+      if (!poll(m)) {
+        rearm();
+        return false;
+      }
+    } while (drop_expired<Msg...>(m, clock::now()));
+    return handle_received<Msg...>(m, visitor);
+  }
+
+  // Dequeues up to `max_count` entries in one go and dispatches them back to back. Entries
+  // the visitor rejects are deferred. Returns the number of messages handled.
+  //
+  // If an entry can't be handled, the entries dequeued after it are deferred (and due right
+  // away) before `unknown_message` is thrown.
+  template <message... Msg> std::size_t receive_many(auto visitor, std::size_t max_count) {
+    if (max_count == 0) {
+      return 0;
+    }
+    select<Msg...>();
+    auto &ms = batch_;
+    ms.resize(std::max(ms.size(), max_count));
+    std::size_t count = next(ms.data(), max_count, clock::now() + std::chrono::milliseconds(500));
+    if (count > 0) {
+      signal_dequeued();
+    }
+    std::size_t handled = 0;
+    // Expired entries are skipped against one reading of the clock
+    auto now = clock::now();
+    bool dropped = false;
+    for (std::size_t i = 0; i < count; i++) {
+      if (drop_expired<Msg...>(ms[i], now)) {
+        dropped = true;
+        continue;
+      }
+      bool accepted;
+      try {
+        accepted = dispatch<Msg...>(ms[i], visitor);
+      } catch (...) {
+        forget_retry(ms[i]);
+        auto now = clock::now();
+        for (std::size_t j = count; j > i + 1; j--) {
+          deferred_.push_front({.m = ms[j - 1], .retry_at = now, .delay = clock::duration::zero()});
+        }
+        throw;
+      }
+      if (accepted) {
+        forget_retry(ms[i]);
+        handled++;
+      } else {
+        defer(ms[i]);
+      }
+    }
+    if (handled > 0 || dropped) {
+      drained();
+    }
+    return handled;
+  }
+
+  // Number of rejected messages held by this receiver
+  std::size_t deferred() const { return deferred_.size(); }
+
+  // Returns a file descriptor (a Unix datagram socket) to add to an event loop. It becomes
+  // readable when messages are pending; once it does, call `try_receive()` until it returns
+  // `false`, which makes it unreadable again until the next message arrives.
+  //
+  // Senders, in this process or any other, only signal it when a message arrives while this
+  // receiver is known to be idle, not on every send. Scheduled messages and deferred retries
+  // that fall due don't signal it; see `next_wake()`.
+  int native_handle() {
+    if (!event_) {
+      event_.emplace();
+      poller_ = watchers_->pollers.add(event_->path());
+      if (poller_ == nullptr) {
+        event_.reset();
+        throw std::runtime_error("endpoint is polled by too many receivers");
+      }
+      poller_id_ = poller_->id.load(std::memory_order_relaxed);
+      rearm();
+    }
+    return event_->native_handle();
+  }
+
+  // When the next scheduled message or deferred retry is due; `clock::time_point::max()` if
+  // there are none. Event loops polling `native_handle()` call `try_receive()` by then even
+  // if it doesn't become readable.
+  clock::time_point next_wake() {
+    auto *wheel = timers(false);
+    return std::min(next_retry(),
+                    wheel == nullptr ? clock::time_point::max() : wheel->park_until());
+  }
+
+  // Awaitable returned by `next()`
+  template <message... Msg> struct next_operation : pending_operation {
+    explicit next_operation(receiver &receiver) : receiver_(receiver) {}
+
+    bool await_ready() { return try_complete(); }
+
+    template <typename Promise> void await_suspend(std::coroutine_handle<Promise> handle) {
+      handle.promise().get_executor().suspend(handle, *this, receiver_.watchers_->readable);
+    }
+
+    std::variant<message_envelope_receipt<Msg>...> await_resume() {
+      return receiver_.receipt_of<Msg...>(m_);
+    }
+
+    bool try_complete() override {
+      receiver_.select<Msg...>();
+      do {
+        if (!receiver_.poll(m_)) {
+          return false;
+        }
+      } while (receiver_.drop_expired<Msg...>(m_, clock::now()));
+      return true;
+    }
+
+    clock::time_point retry_at() override { return receiver_.next_wake(); }
+
+  private:
+    receiver &receiver_;
+    msg m_;
+  };
+
+  // Receives from within a `task`: suspends it until one of `Msg` arrives and returns the
+  // message's receipt
+  template <message... Msg> next_operation<Msg...> next() { return next_operation<Msg...>(*this); }
+
+  // Replies to the request that is being handled, so only valid from within a visitor. The
+  // reply is sent to the caller's reply endpoint and satisfies its `sender::call()`. Nothing
+  // is sent (and nothing returned) if the caller is gone.
+  template <message M, typename... Args>
+  std::optional<message_envelope_receipt<M>> reply(Args &&...args) {
+    if (request_ == nullptr || request_->rpc() == nullptr) {
+      throw std::logic_error("not handling a request");
+    }
+    auto replier = replier_for(request_->rpc()->reply_to.get());
+    if (replier == nullptr) {
+      return std::nullopt;
+    }
+    auto &sender = replier->sender;
+    auto receipt =
+        sender.make_envelope_as<M>(envelope_header::correlated, nullptr,
+                                   std::forward<Args>(args)...);
+    receipt.envelope->rpc()->correlation = request_->rpc()->correlation;
+    auto m = sender.entry<M>(receipt, receipt.offset(), 0);
+    // A caller that is gone doesn't make room any more
+    while (!sender.transport_->push_until(m, 0, clock::now() + std::chrono::milliseconds(10))) {
+      if (replier->link->closed.load(std::memory_order_acquire)) {
+        receipt.unpublish();
+        return std::nullopt;
+      }
+    }
+    sender.signal_queued();
+    return receipt;
+  }
+
+private:
+  // Clears the event handle (if any) and arms it for the next message. If one arrived in the
+  // meantime, signals it right away.
+  void rearm() {
+    if (poller_ == nullptr) {
+      return;
+    }
+    event_->reset();
+    poller_->armed.store(true, std::memory_order_seq_cst);
+    if (!transport_->empty() && poller_->armed.exchange(false)) {
+      event_handle::signal(event_->path(), signal_error_);
+    }
+  }
+
+  template <message... Msg>
+  std::variant<message_envelope_receipt<Msg>...> receipt_of(const msg &m) {
+    std::optional<std::variant<message_envelope_receipt<Msg>...>> receipt;
+    ((m.hash == message_tag<Msg>() &&
+      (receipt.emplace(message_envelope_receipt<Msg>(
+           reinterpret_cast<message_envelope<Msg> *>(
+               static_cast<char *>(arena_.get_address()) + m.offset),
+           arena_, false)),
+       true)) ||
+     ...);
+    forget_retry(m);
+    if (!receipt) {
+      throw unknown_message(m.hash);
+    }
+    drained();
+    return std::move(*receipt);
+  }
+
+  // Frees the message without handling it if it has expired. Messages of types other than
+  // `Msg` can't be destroyed here, so they are dispatched as usual.
+  template <message... Msg> bool drop_expired(const msg &m, clock::time_point now) {
+    if (m.expires == 0 || m.expires > now.time_since_epoch().count()) {
+      return false;
+    }
+    bool dropped =
+        ((m.hash == message_tag<Msg>() &&
+          (message_envelope_receipt<Msg>(reinterpret_cast<message_envelope<Msg> *>(
+                                             static_cast<char *>(arena_.get_address()) + m.offset),
+                                         arena_, false),
+           true)) ||
+         ...);
+    if (dropped) {
+      forget_retry(m);
+      stats_.expired++;
+    }
+    return dropped;
+  }
+
+  template <message... Msg> bool handle_received(msg &m, auto &visitor) {
+    bool accepted;
+    try {
+      accepted = dispatch<Msg...>(m, visitor);
+    } catch (...) {
+      forget_retry(m);
+      throw;
+    }
+    if (!accepted) {
+      defer(m);
+      return false;
+    }
+    forget_retry(m);
+    drained();
+    return true;
+  }
+
+  struct deferred_msg {
+    msg m;
+    clock::time_point retry_at;
+    // Delay this message was deferred for the last time
+    clock::duration delay;
+  };
+
+  void defer(const msg &m) {
+    auto &policy = options_.retry;
+    clock::duration delay = policy.initial_delay;
+    if (auto it = retrying_.find(m.offset); it != retrying_.end()) {
+      delay = std::min<clock::duration>(std::max(it->second * 2, delay), policy.max_delay);
+      retrying_.erase(it);
+    }
+    deferred_.push_back({.m = m, .retry_at = clock::now() + delay, .delay = delay});
+  }
+
+  void forget_retry(const msg &m) {
+    if (!retrying_.empty()) {
+      retrying_.erase(m.offset);
+    }
+  }
+
+  // Moves deferred entries that are due into `ms`, oldest first
+  std::size_t take_deferred(msg *ms, std::size_t max, clock::time_point now) {
+    std::size_t count = 0;
+    for (auto it = deferred_.begin(); it != deferred_.end() && count < max;) {
+      if (it->retry_at <= now && selected(it->m.hash)) {
+        ms[count++] = it->m;
+        // Remembered so that the next rejection backs off further
+        retrying_[it->m.offset] = it->delay;
+        it = deferred_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return count;
+  }
+
+  clock::time_point next_retry() const {
+    auto earliest = clock::time_point::max();
+    for (auto &d : deferred_) {
+      if (selected(d.m.hash)) {
+        earliest = std::min(earliest, d.retry_at);
+      }
+    }
+    return earliest;
+  }
+
+  // Returns `false` if the visitor rejected the message
+  template <message... Msg> bool dispatch(msg &m, auto &visitor) {
+    (envelope_releasers::add<Msg>(), ...);
+    bool matched = false;
+    bool accepted = true;
+
+    (try_handle<Msg>(m, matched, accepted, visitor), ...);
+
+    if (!matched) {
+      if constexpr (requires(decltype(visitor) v, msg &index) {
+                      { v(index) };
+                    }) {
+        using return_type = std::invoke_result_t<decltype(visitor), msg &>;
+        if constexpr (std::same_as<return_type, bool>) {
+          accepted = visitor(m);
+        } else {
+          visitor(m);
+        }
+        matched = true;
+      }
+    }
+
+    if (!accepted) {
+      return false;
+    }
+    if (!matched) {
+      throw unknown_message(m.hash);
+    }
+    return true;
+  }
+
+  void drained() {
+    if (transport_->empty()) {
+      auto [lock, container] = msgs_->scoped_lock();
+      container.clear();
+    }
+  }
+
+  // Returns deferred entries that are due or dequeues up to `max` entries, waiting for the
+  // first one according to the wait policy (but no longer than until the next retry)
+  //
+  // Scheduled messages that are due are moved to the queue first, and waits last no longer
+  // than until the next one is due.
+  std::size_t next(msg *ms, std::size_t max, clock::time_point deadline) {
+    for (;;) {
+      release_timers();
+      if (std::size_t n = take_deferred(ms, max, clock::now()); n > 0) {
+        return n;
+      }
+      auto wake = next_wake();
+      bool final = wake >= deadline;
+      std::size_t n = 0;
+      for (std::size_t i = 0, count = wait(ms, max, final ? deadline : wake, final); i < count;
+           i++) {
+        if (claim(ms[i])) {
+          ms[n++] = ms[i];
+        }
+      }
+      if (n > 0) {
+        return n;
+      }
+      if (final && clock::now() >= deadline) {
+        return 0;
+      }
+    }
+  }
+
+  // Takes a due deferred entry or dequeues one without waiting
+  bool poll(msg &m) {
+    release_timers();
+    if (take_deferred(&m, 1, clock::now()) == 1) {
+      return true;
+    }
+    while (!transport_->empty() && transport_->try_pop(m)) {
+      stats_.immediate++;
+      signal_dequeued();
+      if (claim(m)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Dequeues up to `max` entries, waiting for the first one according to the wait policy.
+  // Only counts a timeout if `final`.
+  std::size_t wait(msg *ms, std::size_t max, clock::time_point deadline, bool final = true) {
+    if (std::size_t n = transport_->try_pop_many(ms, max); n > 0) {
+      stats_.immediate++;
+      return n;
+    }
+
+    auto &policy = options_.wait;
+    if (policy.strategy == wait_strategy::park) {
+      return parked(ms, max, deadline, final);
+    }
+
+    for (std::size_t i = 0;
+         policy.strategy == wait_strategy::busy_spin || i < policy.spin_count; i++) {
+      stats_.spins++;
+      if (std::size_t n = transport_->try_pop_many(ms, max); n > 0) {
+        stats_.spun++;
+        return n;
+      }
+      // Reading the clock costs more than a poll, so only do it every so often
+      if (i % 64 == 63 && clock::now() >= deadline) {
+        stats_.timed_out += final;
+        return 0;
+      }
+      cpu_relax();
+    }
+
+    if (policy.strategy == wait_strategy::spin_then_park) {
+      return parked(ms, max, deadline, final);
+    }
+
+    while (clock::now() < deadline) {
+      std::this_thread::yield();
+      if (std::size_t n = transport_->try_pop_many(ms, max); n > 0) {
+        stats_.yielded++;
+        return n;
+      }
+    }
+    stats_.timed_out += final;
+    return 0;
+  }
+
+  std::size_t parked(msg *ms, std::size_t max, clock::time_point deadline, bool final) {
+    if (std::size_t n = transport_->pop_many_until(ms, max, deadline); n > 0) {
+      stats_.parked++;
+      return n;
+    }
+    stats_.timed_out += final;
+    return 0;
+  }
+
+  wait_stats stats_;
+  // Reused between `receive_many` calls
+  std::vector<msg> batch_;
+  // Rejected entries, in the order they were rejected
+  std::deque<deferred_msg> deferred_;
+  // Last delay of deferred entries that are being offered again, by envelope offset
+  std::unordered_map<std::ptrdiff_t, clock::duration> retrying_;
+  // Envelope being handled by the visitor
+  envelope_header *request_ = nullptr;
+  // Created by `native_handle()`
+  std::optional<event_handle> event_;
+  poll_list::slot *poller_ = nullptr;
+  std::uint64_t poller_id_ = 0;
+  // Sender to a caller's reply endpoint, attached to it
+  struct replier {
+    replier(arena &arena, const char *name, reply_channel::link *link)
+        : link(link), sender(arena, name, reply_channel::max_replies, reply_channel::options) {}
+
+    reply_channel::link *link;
+    oink::sender sender;
+  };
+
+  // Senders to reply endpoints, by name
+  std::unordered_map<std::string, replier> repliers_;
+
+  // Attaches to the reply endpoint on first use; null if its caller is gone. Lets go of the
+  // endpoints of other callers that are gone on the way.
+  replier *replier_for(const char *name) {
+    for (auto it = repliers_.begin(); it != repliers_.end();) {
+      if (it->second.link->closed.load(std::memory_order_acquire)) {
+        detach(it->first, it->second);
+        it = repliers_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    auto it = repliers_.find(name);
+    if (it == repliers_.end()) {
+      auto link = reply_channel::attach(arena_, name);
+      if (link == nullptr) {
+        return nullptr;
+      }
+      it = repliers_.try_emplace(name, arena_, name, link).first;
+    }
+    return &it->second;
+  }
+
+  void detach(const std::string &name, replier &replier) {
+    reply_channel::detach(arena_, name.c_str(), replier.link, *replier.sender.transport_);
+  }
+
+  template <message T> void try_handle(msg &j, bool &matched, bool &accepted, auto visitor) {
+    if (j.hash == message_tag<T>()) {
+      // Visitors that also take a `priority` get the one the message was sent with
+      if constexpr (requires(decltype(visitor) v, T &index, priority p) {
+                      { v(index, p) };
+                    }) {
+        handle<T>(j, matched, accepted,
+                  [&](T &message) { return visitor(message, priority{j.priority}); });
+      } else if constexpr (requires(decltype(visitor) v, T &index) {
+                             { v(index) };
+                           }) {
+        handle<T>(j, matched, accepted, visitor);
+      }
+    }
+  }
+
+  template <message T> void handle(msg &j, bool &matched, bool &accepted, auto &&visitor) {
+    using return_type = std::invoke_result_t<decltype(visitor), T &>;
+    message_envelope_receipt<T> p(reinterpret_cast<message_envelope<T> *>(
+                                      static_cast<char *>(arena_.segment.get_address()) + j.offset),
+                                  arena_, false);
+    // Lets the visitor `reply()` until it returns
+    request_ = p.envelope;
+    struct handling {
+      envelope_header *&request;
+      ~handling() { request = nullptr; }
+    } handling{request_};
+    if constexpr (std::same_as<return_type, bool>) {
+      accepted = visitor(p.operator T &());
+    } else {
+      visitor(p.operator T &());
+    }
+    matched = true;
+    if (!accepted) {
+      p.retain();
+    }
+  }
+};
+
+// Fans one message out to many subscriber endpoints.
+//
+// The message is constructed once in the arena and every subscriber queue gets the offset of
+// the same envelope, so subscribers read the same bytes and nothing is copied. The envelope is
+// freed once every subscriber (and the publisher's receipt) is done with it. It is allocated
+// the way the first subscriber's sender would (slab pools, credits); conflating subscribers
+// conflate it like any message sent to them.
+struct publisher {
+  explicit publisher(arena &arena) : arena_(arena) {}
+
+  void subscribe(const char *mq_segment_name, size_t mq_max_messages,
+                 endpoint_options options = {}) {
+    subscribers_.emplace_back(arena_, mq_segment_name, mq_max_messages, options);
+  }
+
+  std::size_t subscribers() const { return subscribers_.size(); }
+
+  template <message M, typename... Args> message_envelope_receipt<M> publish(Args &&...args) {
+    return publish<M>(priority{}, std::forward<Args>(args)...);
+  }
+
+  // Blocks while any of the subscriber queues is full (or the first subscriber is out of
+  // credits). If queueing fails, subscribers queued so far keep the message.
+  template <message M, typename... Args>
+  message_envelope_receipt<M> publish(priority priority, Args &&...args) {
+    if (subscribers_.empty()) {
+      throw std::logic_error("publisher has no subscribers");
+    }
+    auto receipt = subscribers_.front().make_envelope<M>(std::forward<Args>(args)...);
+    receipt.share(subscribers_.size() - 1);
+    for (std::size_t i = 0; i < subscribers_.size(); i++) {
+      try {
+        subscribers_[i].push(receipt, priority);
+      } catch (...) {
+        // `push` gave up its own share, those of the subscribers after it are left
+        receipt.unpublish(subscribers_.size() - i - 1);
+        throw;
+      }
+    }
+    return receipt;
+  }
+
+private:
+  arena &arena_;
+  std::vector<sender> subscribers_;
+};
+
+// Spreads the messages of one endpoint over a number of workers (each meant for a thread of
+// its own) that balance the load among themselves.
+//
+// Every worker has local queues in the arena. A worker with nothing to do first pulls a batch
+// from the endpoint into its local queue (one worker at a time); if the endpoint is empty too,
+// it steals half of the local queue of a busy worker. Idle workers park on a notifier that
+// watches the endpoint and is signalled whenever local queues get work.
+struct receiver_pool {
+  using clock = receiver::clock;
+
+  // Entries pulled from the endpoint (or stolen) at once
+  static constexpr std::size_t batch_size = 32;
+
+  receiver_pool(arena &arena, const char *mq_segment_name, size_t mq_max_messages,
+                std::size_t workers, endpoint_options options = {})
+      : arena_(arena), notifier_(arena.get_segment_manager()->construct<cache_padded<notifier>>(
+                           bip::anonymous_instance)()) {
+    auto capacity = std::max(mq_max_messages, batch_size);
+    workers_.reserve(workers);
+    for (std::size_t i = 0; i < std::max<std::size_t>(workers, 1); i++) {
+      workers_.push_back(std::unique_ptr<worker>(
+          new worker(*this, i, mq_segment_name, mq_max_messages, options, capacity)));
+    }
+    if (!source().watchers_->readable.add(arena_, notifier_->value)) {
+      throw std::runtime_error("endpoint is watched by too many executors");
+    }
+  }
+
+  receiver_pool(const receiver_pool &) = delete;
+  receiver_pool &operator=(const receiver_pool &) = delete;
+
+  // Entries still in local queues go back to the endpoint
+  ~receiver_pool() {
+    source().watchers_->readable.remove(arena_, notifier_->value);
+    // Entries workers still hold go back to the endpoint; those that don't fit are released
+    bool queued = false;
+    auto hand_back = [&](const endpoint::msg &m) {
+      if (source().transport_->try_push(m, m.priority)) {
+        queued = true;
+      } else {
+        envelope_releasers::release(arena_, m);
+      }
+    };
+    endpoint::msg m;
+    for (auto &worker : workers_) {
+      while (worker->pinned_->try_pop(m) || worker->local_->try_pop(m)) {
+        hand_back(m);
+      }
+      for (auto &m : worker->overflow_) {
+        hand_back(m);
+      }
+    }
+    if (queued) {
+      source().signal_queued();
+    }
+    workers_.clear();
+    arena_.get_segment_manager()->destroy_ptr(notifier_);
+  }
+
+  // Keeps messages of these types in the order they were sent: each of them is handed to one
+  // worker only (picked by its type) and never stolen. Must be called before receiving.
+  template <message... Msg> void keep_order() { (ordered_.push_back(message_tag<Msg>()), ...); }
+
+  std::size_t size() const { return workers_.size(); }
+
+  struct worker {
+    worker(const worker &) = delete;
+    worker &operator=(const worker &) = delete;
+
+    ~worker() {
+      auto segment_manager = pool_.arena_.get_segment_manager();
+      segment_manager->destroy_ptr(local_);
+      segment_manager->destroy_ptr(pinned_);
+    }
+
+    // Waits up to 500ms for a message
+    template <message... Msg> bool receive(auto visitor) {
+      return receive_for<Msg...>(visitor, std::chrono::milliseconds(500));
+    }
+
+    template <message... Msg, typename Rep, typename Period>
+    bool receive_for(auto visitor, std::chrono::duration<Rep, Period> timeout) {
+      auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(timeout);
+      return receive_until<Msg...>(visitor, deadline);
+    }
+
+    template <message... Msg> bool receive_until(auto visitor, clock::time_point deadline) {
+      endpoint::msg m;
+      auto take_live = [&] {
+        while (take(m)) {
+          if (!receiver_.drop_expired<Msg...>(m, clock::now())) {
+            return true;
+          }
+        }
+        return false;
+      };
+      // Scheduled messages and retries that fall due don't signal the pool
+      for (;;) {
+        auto wake = std::min(deadline, receiver_.next_wake());
+        if (pool_.notifier_->value.wait_until(take_live, wake)) {
+          break;
+        }
+        if (wake == deadline) {
+          return false;
+        }
+      }
+      return receiver_.handle_received<Msg...>(m, visitor);
+    }
+
+    template <message... Msg> bool try_receive(auto visitor) {
+      endpoint::msg m;
+      do {
+        if (!take(m)) {
+          return false;
+        }
+      } while (receiver_.drop_expired<Msg...>(m, clock::now()));
+      return receiver_.handle_received<Msg...>(m, visitor);
+    }
+
+    const wait_stats &get_wait_stats() const { return receiver_.get_wait_stats(); }
+
+    // Number of entries this worker took from other workers
+    std::size_t stolen() const { return stolen_; }
+
+  private:
+    friend struct receiver_pool;
+
+    worker(receiver_pool &pool, std::size_t index, const char *name, size_t max_messages,
+           const endpoint_options &options, std::size_t capacity)
+        : pool_(pool), index_(index), receiver_(pool.arena_, name, max_messages, options),
+          local_(pool.arena_.get_segment_manager()->construct<mpmc_ring<endpoint::msg>>(
+              bip::anonymous_instance)(capacity, pool.arena_.get_allocator<endpoint::msg>())),
+          pinned_(pool.arena_.get_segment_manager()->construct<spsc_ring<endpoint::msg>>(
+              bip::anonymous_instance)(capacity, pool.arena_.get_allocator<endpoint::msg>())) {}
+
+    bool take(endpoint::msg &m) {
+      receiver_.release_timers();
+      if (receiver_.take_deferred(&m, 1, clock::now()) == 1) {
+        return true;
+      }
+      for (;;) {
+        if (pinned_->try_pop(m) || local_->try_pop(m)) {
+          return true;
+        }
+        if (!pool_.refill(*this)) {
+          return steal(m);
+        }
+      }
+    }
+
+    // Takes half of the local queue of the first busy worker after this one
+    bool steal(endpoint::msg &m) {
+      auto &workers = pool_.workers_;
+      for (std::size_t i = 1; i < workers.size(); i++) {
+        auto &victim = *workers[(index_ + i) % workers.size()];
+        std::size_t available = victim.local_->size();
+        if (available == 0) {
+          continue;
+        }
+        endpoint::msg stolen[batch_size];
+        std::size_t count =
+            victim.local_->try_pop_many(stolen, std::min(batch_size, (available + 1) / 2));
+        if (count == 0) {
+          continue;
+        }
+        stolen_ += count;
+        m = stolen[0];
+        local_->try_push_many(stolen + 1, count - 1);
+        return true;
+      }
+      return false;
+    }
+
+    receiver_pool &pool_;
+    std::size_t index_;
+    // Dispatches and keeps the entries the visitor rejects
+    receiver receiver_;
+    // Entries any worker may steal
+    mpmc_ring<endpoint::msg> *local_;
+    // Entries of ordered types; filled under `refill_mutex_` and only read by this worker
+    spsc_ring<endpoint::msg> *pinned_;
+    // Entries of ordered types that didn't fit into `pinned_` yet, oldest first; guarded by
+    // `refill_mutex_`
+    std::deque<endpoint::msg> overflow_;
+    std::size_t stolen_ = 0;
+  };
+
+  worker &operator[](std::size_t index) { return *workers_[index]; }
+
+private:
+  receiver &source() { return workers_.front()->receiver_; }
+
+  // Pulls a batch from the endpoint on behalf of `w`, unless somebody else is at it. Returns
+  // `true` if anything was pulled.
+  //
+  // Ordered entries whose worker has no room for them wait in its overflow, and nothing more
+  // is pulled until they've moved on, so that an idle worker holds up no one but its senders.
+  bool refill(worker &w) {
+    std::unique_lock lock(refill_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+      return false;
+    }
+    bool moved = false, overflowing = false;
+    for (auto &worker : workers_) {
+      auto &overflow = worker->overflow_;
+      while (!overflow.empty() && worker->pinned_->try_push(overflow.front())) {
+        overflow.pop_front();
+        moved = true;
+      }
+      overflowing |= !overflow.empty();
+    }
+    if (overflowing) {
+      lock.unlock();
+      if (moved) {
+        notifier_->value.notify();
+      }
+      return moved;
+    }
+    endpoint::msg ms[batch_size];
+    w.receiver_.select<>();
+    std::size_t count = w.receiver_.transport_->try_pop_many(ms, batch_size);
+    if (count == 0) {
+      if (moved) {
+        lock.unlock();
+        notifier_->value.notify();
+      }
+      return moved;
+    }
+    w.receiver_.signal_dequeued();
+    for (std::size_t i = 0; i < count; i++) {
+      auto &m = ms[i];
+      if (!w.receiver_.claim(m)) {
+        continue;
+      }
+      if (std::ranges::find(ordered_, m.hash) != ordered_.end()) {
+        auto &owner = *workers_[m.hash % workers_.size()];
+        // Behind the ones waiting already, if any
+        if (!owner.overflow_.empty() || !owner.pinned_->try_push(m)) {
+          owner.overflow_.push_back(m);
+        }
+      } else {
+        // Our own queue is empty, so a batch fits
+        w.local_->try_push(m);
+      }
+    }
+    lock.unlock();
+    // Lets idle workers steal the rest
+    notifier_->value.notify();
+    return true;
+  }
+
+  arena &arena_;
+  cache_padded<notifier> *notifier_;
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::vector<std::size_t> ordered_;
+  std::mutex refill_mutex_;
+};
+
+struct executor;
+
+// Coroutine run by an `executor`, which can await `receiver::next()` and
+// `sender::send_async()`
+struct task {
+  struct promise_type {
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // Suspends so that the executor can collect the exception
+    std::suspend_always final_suspend() noexcept { return {}; }
+
+    void return_void() {}
+
+    void unhandled_exception() { exception = std::current_exception(); }
+
+    executor &get_executor() { return *executor_; }
+
+    executor *executor_ = nullptr;
+    std::exception_ptr exception;
+  };
+
+  task(task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  task &operator=(task &&) = delete;
+
+  ~task() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+private:
+  friend struct executor;
+
+  explicit task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Runs tasks on the calling thread, so that many endpoints can be served without a thread
+// each.
+//
+// A task waiting on an endpoint is suspended and the executor watches the endpoint with a
+// notifier of its own. The notifier lives in the arena, so senders and receivers in any
+// process wake the executor up, and the waiting operations are only attempted again then.
+struct executor {
+  using clock = std::chrono::steady_clock;
+
+  explicit executor(arena &arena)
+      : arena_(arena), notifier_(arena.get_segment_manager()->construct<cache_padded<notifier>>(
+                           bip::anonymous_instance)()) {}
+
+  executor(const executor &) = delete;
+  executor &operator=(const executor &) = delete;
+
+  // Destroys the tasks that didn't finish
+  ~executor() {
+    for (auto watchers : watching_) {
+      watchers->remove(arena_, notifier_->value);
+    }
+    for (auto &w : waiting_) {
+      w.handle.destroy();
+    }
+    for (auto handle : ready_) {
+      handle.destroy();
+    }
+    arena_.get_segment_manager()->destroy_ptr(notifier_);
+  }
+
+  void spawn(task task) {
+    auto handle = std::exchange(task.handle_, {});
+    handle.promise().executor_ = this;
+    ready_.push_back(handle);
+  }
+
+  // Runs until all tasks finish
+  void run() { run_until(clock::time_point::max()); }
+
+  // Returns `false` if some tasks are still waiting at the deadline. If a task fails, its
+  // exception is rethrown; the other tasks can still be run afterwards.
+  bool run_until(clock::time_point deadline) {
+    for (;;) {
+      while (!ready_.empty()) {
+        auto handle = ready_.front();
+        ready_.pop_front();
+        handle.resume();
+        if (handle.done()) {
+          auto exception = handle.promise().exception;
+          handle.destroy();
+          if (exception) {
+            std::rethrow_exception(exception);
+          }
+        }
+      }
+      if (waiting_.empty()) {
+        return true;
+      }
+      auto wake = std::min(deadline, retry_at());
+      if (!notifier_->value.wait_until([this] { return poll(); }, wake) && wake == deadline) {
+        return false;
+      }
+    }
+  }
+
+  // Number of tasks that haven't finished
+  std::size_t tasks() const { return ready_.size() + waiting_.size(); }
+
+  // Called by awaitables: parks `handle` until `operation` completes. `watchers` are
+  // signalled whenever it may have become possible.
+  void suspend(std::coroutine_handle<task::promise_type> handle, pending_operation &operation,
+               watch_list &watchers) {
+    suspend(handle, operation, {&watchers});
+  }
+
+  // For operations that any of `watchers` may make possible
+  void suspend(std::coroutine_handle<task::promise_type> handle, pending_operation &operation,
+               std::initializer_list<watch_list *> watchers) {
+    for (auto list : watchers) {
+      if (std::ranges::find(watching_, list) == watching_.end()) {
+        if (!list->add(arena_, notifier_->value)) {
+          throw std::runtime_error("endpoint is watched by too many executors");
+        }
+        watching_.push_back(list);
+      }
+    }
+    waiting_.push_back({.handle = handle, .operation = &operation});
+  }
+
+private:
+  struct waiting {
+    std::coroutine_handle<task::promise_type> handle;
+    pending_operation *operation;
+  };
+
+  // When the first waiting operation wants to be attempted again regardless
+  clock::time_point retry_at() {
+    auto earliest = clock::time_point::max();
+    for (auto &w : waiting_) {
+      earliest = std::min(earliest, w.operation->retry_at());
+    }
+    return earliest;
+  }
+
+  // Moves the tasks whose operations complete now over to `ready_`
+  bool poll() {
+    std::erase_if(waiting_, [this](auto &w) {
+      if (w.operation->try_complete()) {
+        ready_.push_back(w.handle);
+        return true;
+      }
+      return false;
+    });
+    return !ready_.empty();
+  }
+
+  arena &arena_;
+  cache_padded<notifier> *notifier_;
+  std::vector<watch_list *> watching_;
+  std::deque<std::coroutine_handle<task::promise_type>> ready_;
+  std::vector<waiting> waiting_;
 };
 
 } // namespace oink
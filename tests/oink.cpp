@@ -1,6 +1,18 @@
 #include "doctest.h"
 
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <ranges>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -170,67 +182,1821 @@ TEST_CASE("smoke test (multithreading)") {
   }
 }
 
+TEST_SUITE("sender") {
+  TEST_CASE("batch send") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536 * 10);
+
+    for (auto [name, transport] :
+         {std::pair{"oink_test_mq", oink::transport_kind::message_queue},
+          std::pair{"oink_test_spsc", oink::transport_kind::spsc_ring},
+          std::pair{"oink_test_mpsc", oink::transport_kind::mpsc_ring},
+          std::pair{"oink_test_mpmc", oink::transport_kind::mpmc_ring}}) {
+      // Ring smaller than the batch makes the sender publish it in several runs
+      oink::sender endpoint(arena, name, 64, {.transport = transport});
+      oink::receiver rendpoint(arena, name, 64, {.transport = transport});
+
+      std::vector<int> values;
+      std::thread rt([&]() {
+        while (values.size() < 100) {
+          rendpoint.receive<mymsg>(overloaded{[&](mymsg &msg) { values.push_back(msg.i); }});
+        }
+      });
+
+      auto receipts = endpoint.send_batch<mymsg>(std::views::iota(0, 100));
+      rt.join();
+
+      CHECK(receipts.size() == 100);
+      CHECK(receipts[42]->i == 42);
+      for (int i = 0; auto &v : values) {
+        CHECK(v == i);
+        i++;
+      }
+    }
+  }
+
+  TEST_CASE("heterogeneous batch") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    struct mymsg1 {
+      static constexpr const char *name() { return "msg1"; }
+      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+
+      mymsg1(const char *msg, const oink::allocator<char> &alloc) : message(msg, alloc) {}
+    };
+
+    oink::arena arena("oink_test", 65536);
+    auto initial_free_memory = arena.get_free_memory();
+
+    oink::sender endpoint(arena, "oink_test_mq", 16,
+                          {.transport = oink::transport_kind::mpsc_ring});
+    oink::receiver rendpoint(arena, "oink_test_mq", 16,
+                             {.transport = oink::transport_kind::mpsc_ring});
+
+    {
+      auto batch = endpoint.make_batch();
+      batch.add<mymsg>(1);
+      batch.add<mymsg1>("batch", endpoint.get_allocator<char>());
+      CHECK(batch.size() == 2);
+      batch.send();
+    }
+
+    int received = 0;
+    std::string s;
+    auto visitor = overloaded{[&](mymsg &msg) { received = msg.i; },
+                              [&](mymsg1 &msg) { s = msg.message; }};
+    CHECK(rendpoint.receive<mymsg, mymsg1>(visitor));
+    CHECK(rendpoint.receive<mymsg, mymsg1>(visitor));
+    CHECK(received == 1);
+    CHECK(s == "batch");
+
+    auto free_memory = arena.get_free_memory();
+    {
+      // Unsent batches release their messages
+      auto batch = endpoint.make_batch();
+      batch.add<mymsg>(2);
+    }
+    CHECK(arena.get_free_memory() == free_memory);
+    CHECK(initial_free_memory != free_memory);
+  }
+
+  TEST_CASE("try send") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    struct bigmsg {
+      static constexpr const char *name() { return "bigmsg"; }
+      char data[128 * 1024];
+    };
+
+    struct mymsg1 {
+      static constexpr const char *name() { return "msg1"; }
+      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+
+      mymsg1(std::size_t size, const oink::allocator<char> &alloc) : message(size, 'x', alloc) {}
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    for (auto [name, transport] :
+         {std::pair{"oink_test_mq", oink::transport_kind::message_queue},
+          std::pair{"oink_test_mpsc", oink::transport_kind::mpsc_ring}}) {
+      oink::sender endpoint(arena, name, 2, {.transport = transport});
+      oink::receiver rendpoint(arena, name, 2, {.transport = transport});
+
+      auto r = endpoint.try_send<mymsg>(1);
+      CHECK(r.status == oink::send_status::queued);
+      CHECK((*r.receipt)->i == 1);
+      CHECK(endpoint.try_send<mymsg>(oink::priority{0}, 2));
+
+      auto free_memory = arena.get_free_memory();
+      auto full = endpoint.try_send<mymsg>(3);
+      CHECK(full.status == oink::send_status::queue_full);
+      CHECK(!full.receipt.has_value());
+      CHECK(arena.get_free_memory() == free_memory);
+
+      auto start = std::chrono::steady_clock::now();
+      CHECK(endpoint.send_until<mymsg>(start + std::chrono::milliseconds(20), 3).status ==
+            oink::send_status::queue_full);
+      CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+      CHECK(arena.get_free_memory() == free_memory);
+
+      CHECK(rendpoint.receive<mymsg>(overloaded{[&](mymsg &) {}}));
+      CHECK(endpoint.send_until<mymsg>(std::chrono::steady_clock::now(), 3));
+      CHECK(rendpoint.receive_many<mymsg>(overloaded{[&](mymsg &) {}}, 2) == 2);
+
+      free_memory = arena.get_free_memory();
+      CHECK(endpoint.try_send<bigmsg>().status == oink::send_status::arena_full);
+      CHECK(endpoint.try_send<mymsg1>(128 * 1024, endpoint.get_allocator<char>()).status ==
+            oink::send_status::arena_full);
+      CHECK(arena.get_free_memory() == free_memory);
+    }
+  }
+
+  TEST_CASE("credits") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+    constexpr auto envelope_size = sizeof(oink::message_envelope<mymsg>);
+
+    for (auto limits : {oink::credit_limits{.messages = 2},
+                        oink::credit_limits{.bytes = 2 * envelope_size}}) {
+      auto name = limits.messages > 0 ? "oink_test_msgs" : "oink_test_bytes";
+      oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring,
+                                     .credits = limits};
+      oink::sender endpoint(arena, name, 16, options);
+      oink::receiver rendpoint(arena, name, 16, options);
+
+      auto first = endpoint.try_send<mymsg>(1);
+      auto second = endpoint.try_send<mymsg>(2);
+      CHECK(first.status == oink::send_status::queued);
+      CHECK(second.status == oink::send_status::queued);
+      CHECK(endpoint.try_send<mymsg>(3).status == oink::send_status::no_credit);
+      auto start = std::chrono::steady_clock::now();
+      CHECK(endpoint.send_until<mymsg>(start + std::chrono::milliseconds(20), 3).status ==
+            oink::send_status::no_credit);
+      CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+      // Credits come back once the envelope is freed, not when it's received
+      std::vector<int> received;
+      auto visitor = overloaded{[&](mymsg &msg) { received.push_back(msg.i); }};
+      CHECK(rendpoint.try_receive<mymsg>(visitor));
+      CHECK(endpoint.try_send<mymsg>(3).status == oink::send_status::no_credit);
+      first.receipt.reset();
+      CHECK(endpoint.try_send<mymsg>(3).status == oink::send_status::queued);
+
+      // Blocking sends wait for credits
+      second.receipt.reset();
+      std::thread st([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(rendpoint.try_receive<mymsg>(visitor));
+      });
+      endpoint.send<mymsg>(4);
+      st.join();
+      while (rendpoint.try_receive<mymsg>(visitor)) {
+      }
+      CHECK(received == std::vector<int>{1, 2, 3, 4});
+    }
+  }
+
+  TEST_CASE("conflation") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    static int destroyed = 0;
+    struct quote {
+      static constexpr const char *name() { return "quote"; }
+      quote(std::string symbol, int price) : symbol(std::move(symbol)), price(price) {}
+      ~quote() { destroyed++; }
+      std::string conflation_key() const { return symbol; }
+      std::string symbol;
+      int price;
+    };
+    struct trade {
+      static constexpr const char *name() { return "trade"; }
+      int id;
+    };
+
+    oink::arena arena("oink_test", 65536);
+    oink::endpoint_options options{.transport = oink::transport_kind::spsc_ring,
+                                   .conflation_keys = 8};
+    oink::sender endpoint(arena, "oink_test_conflation", 2, options);
+    oink::receiver rendpoint(arena, "oink_test_conflation", 2, options);
+    auto free_memory = arena.get_free_memory();
+
+    // Updates of a key queued already replace the pending one, even with the queue full
+    for (int price = 0; price < 100; price++) {
+      endpoint.send<quote>("AAA", price);
+      endpoint.send<quote>("BBB", 1000 + price);
+    }
+    CHECK(endpoint.try_send<trade>(1).status == oink::send_status::queue_full);
+    CHECK(endpoint.try_send<quote>("AAA", 100).status == oink::send_status::queued);
+    CHECK(destroyed == 199);
+
+    std::vector<std::string> received;
+    auto visitor = overloaded{
+        [&](quote &msg) { received.push_back(msg.symbol + ":" + std::to_string(msg.price)); },
+        [&](trade &msg) { received.push_back("trade:" + std::to_string(msg.id)); }};
+    CHECK(rendpoint.receive_many<quote, trade>(visitor, 16) == 2);
+    CHECK(received == std::vector<std::string>{"AAA:100", "BBB:1099"});
+
+    // Once received, the next update for the key is queued again; messages without a key
+    // aren't conflated
+    endpoint.send<quote>("AAA", 101);
+    endpoint.send<trade>(1);
+    CHECK(rendpoint.receive_many<quote, trade>(visitor, 16) == 2);
+    CHECK(received.back() == "trade:1");
+    endpoint.send<trade>(2);
+    CHECK(rendpoint.try_receive<quote, trade>(visitor));
+    CHECK(received == std::vector<std::string>{"AAA:100", "BBB:1099", "AAA:101", "trade:1",
+                                               "trade:2"});
+    CHECK(!rendpoint.try_receive<quote, trade>(visitor));
+    CHECK(destroyed == 202);
+    CHECK(arena.get_free_memory() == free_memory);
+
+    // Endpoints have to agree on conflation
+    CHECK_THROWS_AS(oink::sender(arena, "oink_test_conflation", 4,
+                                 {.transport = oink::transport_kind::spsc_ring}),
+                    std::invalid_argument);
+  }
+
+  TEST_CASE("regions") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg1 {
+      static constexpr const char *name() { return "msg1"; }
+      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+
+      mymsg1(const char *msg, const oink::allocator<char> &alloc) : message(msg, alloc) {}
+    };
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpsc_ring};
+    oink::sender endpoint(arena, "oink_test_regions", 64, options);
+    oink::receiver rendpoint(arena, "oink_test_regions", 64, options);
+    auto free_memory = arena.get_free_memory();
+
+    constexpr auto text = "long enough not to fit into the string itself";
+    std::vector<std::string> received;
+    auto visitor = overloaded{[&](mymsg1 &msg) { received.emplace_back(msg.message); }};
+
+    // Envelopes and payloads come from the region, which outlives its handle until the last
+    // message is freed
+    {
+      auto region = endpoint.make_region(16 * 1024);
+      for (int i = 0; i < 20; i++) {
+        endpoint.send<mymsg1>(region, text, region.get_allocator<char>());
+      }
+      auto size = sizeof(oink::message_envelope<mymsg1>) + std::char_traits<char>::length(text);
+      CHECK(region.used() >= 20 * size);
+      auto used = region.used();
+      auto free = arena.get_free_memory();
+      endpoint.send<mymsg1>(text, endpoint.get_allocator<char>());
+      CHECK(region.used() == used);
+      CHECK(arena.get_free_memory() < free);
+    }
+    CHECK(rendpoint.receive_many<mymsg1>(visitor, 20) == 20);
+    CHECK(arena.get_free_memory() < free_memory);
+    CHECK(rendpoint.try_receive<mymsg1>(visitor));
+    CHECK(arena.get_free_memory() == free_memory);
+    CHECK(received.size() == 21);
+    CHECK(std::ranges::all_of(received, [&](auto &s) { return s == text; }));
+
+    // Once the region is full, messages go to the arena, and still keep the region alive
+    {
+      auto region = endpoint.make_region(
+          oink::message_envelope<mymsg1>::size(oink::envelope_header::regional));
+      endpoint.send<mymsg1>(region, text, region.get_allocator<char>());
+      CHECK(region.used() > 0);
+      endpoint.send<mymsg1>(region, text, region.get_allocator<char>());
+    }
+    CHECK(rendpoint.receive_many<mymsg1>(visitor, 16) == 2);
+    CHECK(received.size() == 23);
+    CHECK(arena.get_free_memory() == free_memory);
+  }
+
+  TEST_CASE("envelope fields") {
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+    using envelope = oink::message_envelope<mymsg>;
+    using header = oink::envelope_header;
+
+    // Plain messages carry nothing but the feature bits
+    CHECK(sizeof(envelope) <= sizeof(mymsg) + 2 * sizeof(std::size_t));
+    CHECK(envelope::size(0) == sizeof(envelope));
+    CHECK(envelope::size(header::correlated) == sizeof(envelope) + 16);
+    CHECK(envelope::size(header::credited | header::pooled | header::regional |
+                         header::correlated) == sizeof(envelope) + 40);
+
+    // Fields stay where they were put, whatever else is there
+    alignas(envelope) char block[envelope::size(header::credited | header::regional |
+                                                header::correlated)];
+    auto e = std::construct_at(
+        envelope::in(block, header::credited | header::regional | header::correlated), 1);
+    auto credits = reinterpret_cast<oink::credit_pool *>(0x1000);
+    auto region = reinterpret_cast<oink::region *>(0x2000);
+    e->extend(header::credited | header::regional | header::correlated, credits, nullptr, region);
+    e->rpc()->correlation = 42;
+    CHECK(e->block() == block);
+    CHECK(e->credits() == credits);
+    CHECK(e->pool() == nullptr);
+    CHECK(e->region() == region);
+    CHECK(e->rpc()->correlation == 42);
+    CHECK(e->rpc()->reply_to == nullptr);
+    CHECK(static_cast<mymsg &>(*e).i == 1);
+    std::destroy_at(e);
+  }
+
+  TEST_CASE("slab pools") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    static std::atomic<int> destroyed = 0;
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      explicit mymsg(int i) : i(i) {}
+      ~mymsg() { destroyed++; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring,
+                                   .slab_pools = true};
+    oink::sender endpoint(arena, "oink_test_slabs", 64, options);
+    oink::receiver rendpoint(arena, "oink_test_slabs", 64, options);
+
+    long sum = 0;
+    auto visitor = overloaded{[&](mymsg &msg) { sum += msg.i; }};
+    for (int i = 0; i < 10; i++) {
+      endpoint.send<mymsg>(i);
+    }
+    CHECK(rendpoint.receive_many<mymsg>(visitor, 64) == 10);
+    CHECK(destroyed == 10);
+
+    // Freed envelopes are reused rather than returned to the arena
+    auto free_memory = arena.get_free_memory();
+    for (int round = 0; round < 10; round++) {
+      auto receipts = endpoint.send_batch<mymsg>(std::views::iota(0, 10));
+      CHECK(endpoint.try_send<mymsg>(10).status == oink::send_status::queued);
+      CHECK(rendpoint.receive_many<mymsg>(visitor, 64) == 11);
+    }
+    CHECK(destroyed == 120);
+    CHECK(sum == 45 + 10 * 55);
+    CHECK(arena.get_free_memory() == free_memory);
+
+    // Senders on several threads share the pool
+    constexpr int count = 10000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&] {
+        oink::sender endpoint(arena, "oink_test_slabs", 64, options);
+        for (int i = 0; i < count; i++) {
+          endpoint.send<mymsg>(1);
+        }
+      });
+    }
+    sum = 0;
+    while (sum < 4 * count) {
+      rendpoint.receive_for<mymsg>(visitor, std::chrono::seconds(5));
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    CHECK(sum == 4 * count);
+    CHECK(destroyed == 120 + 4 * count);
+  }
+
+  TEST_CASE("magazines") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 4 * 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpsc_ring,
+                                   .slab_pools = true};
+    oink::receiver rendpoint(arena, "oink_test_magazines", 1024, options);
+    auto send = [&](int count) {
+      std::thread([&] {
+        oink::sender endpoint(arena, "oink_test_magazines", 1024, options);
+        for (int i = 0; i < count; i++) {
+          endpoint.send<mymsg>(i);
+        }
+      }).join();
+    };
+    int received = 0;
+    auto visitor = overloaded{[&](mymsg &) { received++; }};
+
+    // Blocks allocated by one thread and freed by another find their way back to the
+    // allocating side through the pool, including those cached by threads that exited
+    send(1000);
+    while (rendpoint.try_receive<mymsg>(visitor)) {
+    }
+    CHECK(received == 1000);
+    auto free_memory = arena.get_free_memory();
+    send(500);
+    while (rendpoint.try_receive<mymsg>(visitor)) {
+    }
+    CHECK(received == 1500);
+    CHECK(arena.get_free_memory() == free_memory);
+  }
+}
+
+TEST_SUITE("publisher") {
+  TEST_CASE("fan-out") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg1 {
+      static constexpr const char *name() { return "msg1"; }
+      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+
+      mymsg1(const char *msg, const oink::allocator<char> &alloc) : message(msg, alloc) {}
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::publisher publisher(arena);
+    publisher.subscribe("oink_test_mq", 16);
+    publisher.subscribe("oink_test_spsc", 16, {.transport = oink::transport_kind::spsc_ring});
+    publisher.subscribe("oink_test_mpsc", 16, {.transport = oink::transport_kind::mpsc_ring});
+    CHECK(publisher.subscribers() == 3);
+
+    std::vector<std::unique_ptr<oink::receiver>> subscribers;
+    subscribers.push_back(std::make_unique<oink::receiver>(arena, "oink_test_mq", 16));
+    subscribers.push_back(std::make_unique<oink::receiver>(
+        arena, "oink_test_spsc", 16,
+        oink::endpoint_options{.transport = oink::transport_kind::spsc_ring}));
+    subscribers.push_back(std::make_unique<oink::receiver>(
+        arena, "oink_test_mpsc", 16,
+        oink::endpoint_options{.transport = oink::transport_kind::mpsc_ring}));
+
+    auto initial_free_memory = arena.get_free_memory();
+    {
+      auto receipt = publisher.publish<mymsg1>("market data", arena.get_allocator<char>());
+      auto free_memory = arena.get_free_memory();
+
+      std::vector<const mymsg1 *> seen;
+      for (auto &subscriber : subscribers) {
+        CHECK(subscriber->receive<mymsg1>(overloaded{[&](mymsg1 &msg) {
+          CHECK(msg.message == "market data");
+          seen.push_back(&msg);
+        }}));
+      }
+      // Every subscriber saw the very same message, nothing was allocated for them
+      CHECK(seen.size() == 3);
+      CHECK(seen[0] == seen[1]);
+      CHECK(seen[1] == seen[2]);
+      CHECK(arena.get_free_memory() == free_memory);
+      CHECK(receipt->message == "market data");
+    }
+    CHECK(arena.get_free_memory() == initial_free_memory);
+  }
+
+  TEST_CASE("subscriber options") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct quote {
+      static constexpr const char *name() { return "quote"; }
+      std::string conflation_key() const { return symbol; }
+      std::string symbol;
+      int price;
+    };
+
+    oink::arena arena("oink_test", 65536);
+    oink::endpoint_options conflating{.transport = oink::transport_kind::spsc_ring,
+                                      .credits = {.messages = 2},
+                                      .conflation_keys = 8};
+    oink::endpoint_options plain{.transport = oink::transport_kind::spsc_ring};
+
+    oink::publisher publisher(arena);
+    publisher.subscribe("oink_test_conflating", 4, conflating);
+    publisher.subscribe("oink_test_plain", 4, plain);
+    oink::receiver conflating_subscriber(arena, "oink_test_conflating", 4, conflating);
+    oink::receiver plain_subscriber(arena, "oink_test_plain", 4, plain);
+    auto free_memory = arena.get_free_memory();
+
+    publisher.publish<quote>("AAA", 1);
+    publisher.publish<quote>("AAA", 2);
+
+    // Both envelopes count against the credits of the first subscriber's endpoint
+    oink::sender sender(arena, "oink_test_conflating", 4, conflating);
+    CHECK(sender.try_send<quote>("BBB", 1).status == oink::send_status::no_credit);
+
+    std::vector<int> prices;
+    auto visitor = overloaded{[&](quote &msg) { prices.push_back(msg.price); }};
+    CHECK(conflating_subscriber.receive_many<quote>(visitor, 4) == 1);
+    CHECK(prices == std::vector<int>{2});
+    prices.clear();
+    CHECK(plain_subscriber.receive_many<quote>(visitor, 4) == 2);
+    CHECK(prices == std::vector<int>{1, 2});
+
+    CHECK(arena.get_free_memory() == free_memory);
+    CHECK(sender.try_send<quote>("BBB", 1).status == oink::send_status::queued);
+
+    oink::publisher empty(arena);
+    CHECK_THROWS_AS(empty.publish<quote>("AAA", 3), std::logic_error);
+  }
+}
+
+TEST_SUITE("rpc") {
+  TEST_CASE("call and reply") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct square {
+      static constexpr const char *name() { return "square"; }
+      int i;
+    };
+    struct squared {
+      static constexpr const char *name() { return "squared"; }
+      int i;
+    };
+    struct other {
+      static constexpr const char *name() { return "other"; }
+    };
+
+    oink::arena arena("oink_test", 1024 * 1024);
+
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender client(arena, "oink_test_rpc", 16, options);
+    oink::receiver server(arena, "oink_test_rpc", 16, options);
+
+    CHECK_THROWS_AS(server.reply<squared>(0), std::logic_error);
+
+    auto first = client.call<square, squared>(2);
+    auto second = client.call<square, squared>(3);
+    std::thread st([&]() {
+      auto replying = overloaded{[&](square &msg) { server.reply<squared>(msg.i * msg.i); }};
+      // Puts the first request off, so that its reply comes last
+      server.receive<square>(overloaded{[&](square &) { return false; }});
+      server.receive<square>(replying);
+      server.receive<square>(replying);
+    });
+    CHECK(second.wait_for(std::chrono::seconds(5)) == std::future_status::ready);
+    CHECK(second.get()->i == 9);
+    CHECK(first.get()->i == 4);
+    st.join();
+
+    auto mistyped = client.call<square, other>(4);
+    CHECK(server.receive<square>(
+        overloaded{[&](square &msg) { server.reply<squared>(msg.i); }}));
+    CHECK_THROWS_AS(mistyped.get(), std::runtime_error);
+  }
+
+  TEST_CASE("callers that come and go") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct square {
+      static constexpr const char *name() { return "square"; }
+      int i;
+    };
+    struct squared {
+      static constexpr const char *name() { return "squared"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 1024 * 1024);
+
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender requests(arena, "oink_test_rpc", 16, options);
+    auto call = [&](oink::receiver &server) {
+      oink::sender client(arena, "oink_test_rpc", 16, options);
+      auto reply = client.call<square, squared>(3);
+      CHECK(server.receive<square>(
+          overloaded{[&](square &msg) { CHECK(server.reply<squared>(msg.i * msg.i)); }}));
+      CHECK(reply.get()->i == 9);
+    };
+    {
+      oink::receiver server(arena, "oink_test_rpc", 16, options);
+      call(server);
+    }
+    auto free_memory = arena.get_free_memory();
+
+    {
+      oink::receiver server(arena, "oink_test_rpc", 16, options);
+      for (int i = 0; i < 5; i++) {
+        call(server);
+      }
+
+      // Replies to callers that are gone by then aren't sent
+      {
+        oink::sender client(arena, "oink_test_rpc", 16, options);
+        (void)client.call<square, squared>(4);
+      }
+      CHECK(server.receive<square>(
+          overloaded{[&](square &msg) { CHECK(!server.reply<squared>(msg.i)); }}));
+
+      // Nor kept once the caller goes away without waiting for them
+      {
+        oink::sender client(arena, "oink_test_rpc", 16, options);
+        for (int i = 0; i < 8; i++) {
+          (void)client.call<square, squared>(i);
+        }
+        for (int i = 0; i < 8; i++) {
+          CHECK(server.receive<square>(
+              overloaded{[&](square &msg) { CHECK(server.reply<squared>(msg.i)); }}));
+        }
+      }
+    }
+    CHECK(arena.get_free_memory() == free_memory);
+  }
+
+  TEST_CASE("reply channels closed right away") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    { oink::reply_channel channel(arena); }
+    auto free_memory = arena.get_free_memory();
+
+    // Closing races with the channel's thread getting ready to wait; it must never miss that
+    for (int i = 0; i < 2000; i++) {
+      oink::reply_channel channel(arena);
+    }
+    CHECK(arena.get_free_memory() == free_memory);
+  }
+}
+
+TEST_SUITE("coroutines") {
+  struct mymsg {
+    static constexpr const char *name() { return "msg"; }
+    int i;
+  };
+  struct other {
+    static constexpr const char *name() { return "other"; }
+  };
+
+  TEST_CASE("send and receive") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    oink::arena arena("oink_test", 65536);
+
+    for (auto [name, transport] :
+         {std::pair{"oink_test_mq", oink::transport_kind::message_queue},
+          std::pair{"oink_test_mpmc", oink::transport_kind::mpmc_ring}}) {
+      oink::sender tx(arena, name, 2, {.transport = transport});
+      oink::receiver rx(arena, name, 2, {.transport = transport});
+      oink::executor executor(arena);
+
+      // The queue only fits two messages, so both tasks have to take turns
+      auto producer = [&]() -> oink::task {
+        for (int i = 0; i < 10; i++) {
+          auto receipt = co_await tx.send_async<mymsg>(i);
+          CHECK(receipt->i == i);
+        }
+      };
+      std::vector<int> received;
+      auto consumer = [&]() -> oink::task {
+        for (int i = 0; i < 10; i++) {
+          auto receipt = co_await rx.next<mymsg, other>();
+          received.push_back(std::get<0>(receipt)->i);
+        }
+      };
+      executor.spawn(consumer());
+      executor.spawn(producer());
+      CHECK(executor.run_until(std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+      CHECK(received == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+      CHECK(executor.tasks() == 0);
+    }
+  }
+
+  TEST_CASE("waiting for credits") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct failing {
+      static constexpr const char *name() { return "failing"; }
+      explicit failing(int) { throw std::runtime_error("failing"); }
+    };
+
+    oink::arena arena("oink_test", 65536);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring,
+                                   .credits = {.messages = 2}};
+    oink::sender tx(arena, "oink_test_mpmc", 16, options);
+    oink::receiver rx(arena, "oink_test_mpmc", 16, options);
+    oink::executor executor(arena);
+
+    // Only the receiving task gives credits back, so the sending one has to suspend for them
+    // rather than block the thread
+    auto producer = [&]() -> oink::task {
+      for (int i = 0; i < 5; i++) {
+        co_await tx.send_async<mymsg>(i);
+      }
+    };
+    std::vector<int> received;
+    auto consumer = [&]() -> oink::task {
+      for (int i = 0; i < 5; i++) {
+        auto receipt = co_await rx.next<mymsg>();
+        received.push_back(std::get<0>(receipt)->i);
+      }
+    };
+    executor.spawn(producer());
+    executor.spawn(consumer());
+    CHECK(executor.run_until(std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+    CHECK(received == std::vector<int>{0, 1, 2, 3, 4});
+    CHECK(executor.tasks() == 0);
+
+    // Messages that can't be constructed fail the task, and the credits come back
+    auto failed = [&]() -> oink::task { co_await tx.send_async<failing>(1); };
+    executor.spawn(failed());
+    CHECK_THROWS_AS(executor.run(), std::runtime_error);
+    CHECK(tx.try_send<mymsg>(5).status == oink::send_status::queued);
+    CHECK(tx.try_send<mymsg>(6).status == oink::send_status::queued);
+  }
+
+  TEST_CASE("woken up by another thread") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 65536);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender tx(arena, "oink_test_mpmc", 16, options);
+    oink::receiver rx(arena, "oink_test_mpmc", 16, options);
+    oink::executor executor(arena);
+
+    std::optional<int> received;
+    auto consumer = [&]() -> oink::task {
+      auto receipt = co_await rx.next<mymsg>();
+      received = std::get<0>(receipt)->i;
+    };
+    executor.spawn(consumer());
+    CHECK(!executor.run_until(std::chrono::steady_clock::now()));
+    CHECK(executor.tasks() == 1);
+
+    std::thread st([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      tx.send<mymsg>(1);
+    });
+    CHECK(executor.run_until(std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+    st.join();
+    CHECK(received == 1);
+
+    // Failing tasks hand their exception over
+    auto mismatched = [&]() -> oink::task { co_await rx.next<other>(); };
+    executor.spawn(mismatched());
+    tx.send<mymsg>(2);
+    CHECK_THROWS_AS(executor.run(), oink::receiver::unknown_message);
+  }
+
+  TEST_CASE("scheduled messages") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender tx(arena, "oink_test_mpmc", 16, options);
+    oink::receiver rx(arena, "oink_test_mpmc", 16, options);
+    oink::executor executor(arena);
+
+    std::optional<int> received;
+    auto consumer = [&]() -> oink::task {
+      auto receipt = co_await rx.next<mymsg>();
+      received = std::get<0>(receipt)->i;
+    };
+    executor.spawn(consumer());
+    CHECK(!executor.run_until(std::chrono::steady_clock::now()));
+
+    // Nobody sends anything else, so the executor wakes up for it on its own
+    auto start = std::chrono::steady_clock::now();
+    tx.send_after<mymsg>(std::chrono::milliseconds(30), 1);
+    CHECK(executor.run_until(std::chrono::steady_clock::now() + std::chrono::seconds(5)));
+    CHECK(received == 1);
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(30));
+  }
+}
+
+TEST_SUITE("receiver pool") {
+  struct mymsg {
+    static constexpr const char *name() { return "msg"; }
+    int i;
+  };
+  struct ordered {
+    static constexpr const char *name() { return "ordered"; }
+    int i;
+  };
+
+  TEST_CASE("stealing") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender endpoint(arena, "oink_test_pool", 64, options);
+    oink::receiver_pool pool(arena, "oink_test_pool", 64, 2, options);
+    pool.keep_order<ordered>();
+    REQUIRE(pool.size() == 2);
+
+    for (int i = 0; i < 10; i++) {
+      endpoint.send<mymsg>(i);
+    }
+
+    // The first worker pulls everything in and handles one; the second one steals half of
+    // what's left
+    std::vector<int> first, second;
+    CHECK(pool[0].try_receive<mymsg>(overloaded{[&](mymsg &msg) { first.push_back(msg.i); }}));
+    auto to_second = overloaded{[&](mymsg &msg) { second.push_back(msg.i); }};
+    for (int i = 0; i < 5; i++) {
+      CHECK(pool[1].try_receive<mymsg>(to_second));
+    }
+    CHECK(pool[1].stolen() == 5);
+    CHECK(second == std::vector<int>{1, 2, 3, 4, 5});
+    while (pool[0].try_receive<mymsg>(overloaded{[&](mymsg &msg) { first.push_back(msg.i); }})) {
+    }
+    CHECK(first == std::vector<int>{0, 6, 7, 8, 9});
+    CHECK(pool[0].stolen() == 0);
+
+    // Ordered messages only go to their own worker
+    for (int i = 0; i < 4; i++) {
+      endpoint.send<ordered>(i);
+    }
+    auto owner = oink::message_tag<ordered>() % 2;
+    std::vector<int> in_order;
+    auto visitor = overloaded{[&](mymsg &msg) { first.push_back(msg.i); },
+                              [&](ordered &msg) { in_order.push_back(msg.i); }};
+    while (pool[1 - owner].try_receive<mymsg, ordered>(visitor)) {
+    }
+    CHECK(in_order.empty());
+    while (pool[owner].try_receive<mymsg, ordered>(visitor)) {
+    }
+    CHECK(in_order == std::vector<int>{0, 1, 2, 3});
+    CHECK(first.size() + second.size() == 10);
+  }
+
+  TEST_CASE("idle owner") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender endpoint(arena, "oink_test_pool", 256, options);
+    oink::receiver_pool pool(arena, "oink_test_pool", 16, 2, options);
+    pool.keep_order<ordered>();
+
+    // More than the owner's worker can hold while it doesn't receive
+    for (int i = 0; i < 100; i++) {
+      endpoint.send<ordered>(i);
+    }
+    endpoint.send<mymsg>(100);
+    auto owner = oink::message_tag<ordered>() % 2;
+    std::vector<int> in_order, others;
+    auto visitor = overloaded{[&](mymsg &msg) { others.push_back(msg.i); },
+                              [&](ordered &msg) { in_order.push_back(msg.i); }};
+    // The other worker doesn't wait for the owner to make room
+    while (pool[1 - owner].try_receive<mymsg, ordered>(visitor)) {
+    }
+    CHECK(in_order.empty());
+    while (pool[owner].try_receive<mymsg, ordered>(visitor) ||
+           pool[1 - owner].try_receive<mymsg, ordered>(visitor)) {
+    }
+    std::vector<int> expected(100);
+    std::iota(expected.begin(), expected.end(), 0);
+    CHECK(in_order == expected);
+    CHECK(others == std::vector<int>{100});
+  }
+
+  TEST_CASE("entries left in the pool") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender endpoint(arena, "oink_test_pool", 8, options);
+    oink::receiver rendpoint(arena, "oink_test_pool", 8, options);
+    auto free_memory = arena.get_free_memory();
+
+    std::vector<int> received;
+    auto visitor = overloaded{[&](mymsg &msg) { received.push_back(msg.i); },
+                              [&](ordered &msg) { received.push_back(msg.i); }};
+    {
+      oink::receiver_pool pool(arena, "oink_test_pool", 8, 1, options);
+      pool.keep_order<ordered>();
+      for (int i = 0; i < 4; i++) {
+        endpoint.send<mymsg>(i);
+        endpoint.send<ordered>(100 + i);
+      }
+      CHECK(pool[0].try_receive<mymsg, ordered>(visitor));
+      // The pool holds the other 7, and the queue fills up again behind it
+      for (int i = 0; i < 8; i++) {
+        endpoint.send<mymsg>(200 + i);
+      }
+    }
+    // What didn't fit back into the queue was released
+    CHECK(rendpoint.receive_many<mymsg, ordered>(visitor, 16) == 8);
+    CHECK(!rendpoint.try_receive<mymsg, ordered>(visitor));
+    CHECK(arena.get_free_memory() == free_memory);
+
+    // Entries handed back signal the endpoint, so that executors waiting on it find them
+    {
+      auto pool = std::make_unique<oink::receiver_pool>(arena, "oink_test_pool", 8, 1, options);
+      for (int i = 0; i < 4; i++) {
+        endpoint.send<mymsg>(300 + i);
+      }
+      CHECK((*pool)[0].try_receive<mymsg>(visitor));
+      oink::executor executor(arena);
+      auto consumer = [&]() -> oink::task {
+        for (int i = 0; i < 3; i++) {
+          auto receipt = co_await rendpoint.next<mymsg>();
+          received.push_back(std::get<0>(receipt)->i);
+        }
+      };
+      executor.spawn(consumer());
+      CHECK(!executor.run_until(std::chrono::steady_clock::now()));
+      std::thread st([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.reset();
+      });
+      auto start = std::chrono::steady_clock::now();
+      CHECK(executor.run_until(start + std::chrono::seconds(5)));
+      // Rather than finding them by chance at the deadline
+      CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(4));
+      st.join();
+    }
+    CHECK(received.size() == 13);
+    CHECK(arena.get_free_memory() == free_memory);
+  }
+
+  TEST_CASE("multithreading") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 4 * 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring};
+    oink::sender endpoint(arena, "oink_test_pool", 256, options);
+    oink::receiver_pool pool(arena, "oink_test_pool", 256, 4, options);
+    pool.keep_order<ordered>();
+
+    constexpr int count = 4000;
+    std::atomic<int> handled = 0;
+    std::mutex mutex;
+    std::vector<int> seen(count, 0);
+    std::vector<int> in_order;
+
+    std::vector<std::thread> workers;
+    for (std::size_t w = 0; w < pool.size(); w++) {
+      workers.emplace_back([&, w]() {
+        auto visitor = overloaded{[&](mymsg &msg) {
+                                    // Uneven load: some messages take a while
+                                    if (msg.i % 50 == 0) {
+                                      std::this_thread::sleep_for(std::chrono::microseconds(200));
+                                    }
+                                    std::lock_guard lock(mutex);
+                                    seen[msg.i]++;
+                                  },
+                                  [&](ordered &msg) {
+                                    std::lock_guard lock(mutex);
+                                    in_order.push_back(msg.i);
+                                  }};
+        while (handled < count) {
+          if (pool[w].receive_for<mymsg, ordered>(visitor, std::chrono::milliseconds(10))) {
+            handled++;
+          }
+        }
+      });
+    }
+
+    for (int i = 0; i < count / 2; i++) {
+      endpoint.send<mymsg>(i);
+      endpoint.send<ordered>(i);
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+
+    CHECK(std::ranges::all_of(seen | std::views::take(count / 2), [](int n) { return n == 1; }));
+    REQUIRE(in_order.size() == count / 2);
+    CHECK(std::ranges::is_sorted(in_order));
+  }
+}
+
+TEST_SUITE("partitions") {
+  struct transfer {
+    static constexpr const char *name() { return "transfer"; }
+    int account;
+    int seq;
+
+    int partition_key() const { return account; }
+  };
+
+  TEST_CASE("per-key order") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring,
+                                   .partitions = 4};
+    oink::sender endpoint(arena, "oink_test_part", 64, options);
+    oink::receiver a(arena, "oink_test_part", 64, options);
+    oink::receiver b(arena, "oink_test_part", 64, options);
+
+    CHECK_THROWS_AS(oink::receiver(arena, "oink_test_part", 64,
+                                   {.transport = oink::transport_kind::mpmc_ring}),
+                    std::invalid_argument);
+
+    // Lets both receivers join and settle on their partitions
+    std::map<int, std::vector<int>> by_a, by_b;
+    auto to_a = overloaded{[&](transfer &msg) { by_a[msg.account].push_back(msg.seq); }};
+    auto to_b = overloaded{[&](transfer &msg) { by_b[msg.account].push_back(msg.seq); }};
+    for (int i = 0; i < 2; i++) {
+      CHECK(!a.try_receive<transfer>(to_a));
+      CHECK(!b.try_receive<transfer>(to_b));
+    }
+
+    for (int seq = 0; seq < 4; seq++) {
+      for (int account = 0; account < 8; account++) {
+        endpoint.send<transfer>(account, seq);
+      }
+    }
+    while (a.try_receive<transfer>(to_a)) {
+    }
+    while (b.try_receive<transfer>(to_b)) {
+    }
+
+    CHECK(!by_a.empty());
+    CHECK(!by_b.empty());
+    CHECK(by_a.size() + by_b.size() == 8);
+    for (auto &received : {by_a, by_b}) {
+      for (auto &[account, seqs] : received) {
+        CHECK(seqs == std::vector<int>{0, 1, 2, 3});
+      }
+    }
+  }
+
+  TEST_CASE("multithreading") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 4 * 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring,
+                                   .partitions = 8};
+    oink::sender endpoint(arena, "oink_test_part", 64, options);
+
+    constexpr int accounts = 16;
+    constexpr int per_account = 200;
+    std::atomic<int> handled = 0;
+    std::mutex mutex;
+    std::map<int, std::vector<int>> received;
+
+    // Receivers come and go while messages flow, so partitions change hands
+    std::vector<std::thread> receivers;
+    for (int r = 0; r < 4; r++) {
+      receivers.emplace_back([&, r]() {
+        auto visitor = overloaded{[&](transfer &msg) {
+          std::lock_guard lock(mutex);
+          received[msg.account].push_back(msg.seq);
+        }};
+        while (handled < accounts * per_account) {
+          oink::receiver rx(arena, "oink_test_part", 64, options);
+          for (int i = 0; i < 100 * (r + 1) && handled < accounts * per_account; i++) {
+            if (rx.receive_for<transfer>(visitor, std::chrono::milliseconds(5))) {
+              handled++;
+            }
+          }
+        }
+      });
+    }
+
+    for (int seq = 0; seq < per_account; seq++) {
+      for (int account = 0; account < accounts; account++) {
+        endpoint.send<transfer>(account, seq);
+      }
+    }
+    for (auto &receiver : receivers) {
+      receiver.join();
+    }
+
+    REQUIRE(received.size() == accounts);
+    for (auto &[account, seqs] : received) {
+      CHECK(seqs.size() == per_account);
+      CHECK(std::ranges::is_sorted(seqs));
+    }
+  }
+}
+
 TEST_SUITE("receiver") {
   TEST_CASE("unknown message") {
     oink::bip::shared_memory_object::remove("oink_test");
-    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    struct mymsg1 {
+      static constexpr const char *name() { return "msg1"; }
+      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+
+      mymsg1(const char *msg, const oink::allocator<char> &alloc) : message(msg, alloc) {}
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 1024);
+    endpoint.send<mymsg1>("allocator", endpoint.get_allocator<char>());
+
+    oink::receiver rendpoint(arena, "oink_test_mq", 1024);
+
+    CHECK_THROWS_WITH_AS(
+        rendpoint.receive<mymsg>(overloaded{[&](mymsg &) {}}),
+        (std::string("unknown message ") + std::to_string(oink::message_tag<mymsg1>())).c_str(),
+        oink::receiver::unknown_message);
+  }
+
+  TEST_CASE("catch all") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    struct mymsg1 {
+      static constexpr const char *name() { return "msg1"; }
+      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+
+      mymsg1(const char *msg, const oink::allocator<char> &alloc) : message(msg, alloc) {}
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 1024);
+    endpoint.send<mymsg1>("allocator", endpoint.get_allocator<char>());
+
+    oink::receiver rendpoint(arena, "oink_test_mq", 1024);
+
+    std::optional<std::size_t> received_hash = std::nullopt;
+    rendpoint.receive(overloaded{[&](oink::receiver::msg &msg) { received_hash = msg.hash; }});
+    CHECK(received_hash.has_value());
+    CHECK(received_hash.value() == oink::message_tag<mymsg1>());
+  }
+
+  TEST_CASE("wait policies") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    for (auto strategy : {oink::wait_strategy::busy_spin, oink::wait_strategy::spin_then_yield,
+                          oink::wait_strategy::spin_then_park, oink::wait_strategy::park}) {
+      oink::endpoint_options options{.transport = oink::transport_kind::spsc_ring,
+                                     .wait = {.strategy = strategy, .spin_count = 10}};
+      oink::sender endpoint(arena, "oink_test_mq", 16, options);
+      oink::receiver rendpoint(arena, "oink_test_mq", 16, options);
+
+      endpoint.send<mymsg>(1);
+      CHECK(rendpoint.receive<mymsg>(overloaded{[&](mymsg &) {}}));
+      CHECK(rendpoint.get_wait_stats().immediate == 1);
+
+      std::thread st([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        endpoint.send<mymsg>(2);
+      });
+      CHECK(rendpoint.receive<mymsg>(overloaded{[&](mymsg &) {}}));
+      st.join();
+
+      auto &stats = rendpoint.get_wait_stats();
+      switch (strategy) {
+      case oink::wait_strategy::busy_spin:
+        CHECK(stats.spun == 1);
+        break;
+      case oink::wait_strategy::spin_then_yield:
+        CHECK(stats.yielded == 1);
+        break;
+      case oink::wait_strategy::spin_then_park:
+        CHECK(stats.parked == 1);
+        CHECK(stats.spins >= 10);
+        break;
+      case oink::wait_strategy::park:
+        CHECK(stats.parked == 1);
+        CHECK(stats.spins == 0);
+        break;
+      }
+    }
+  }
+
+  TEST_CASE("receive many") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536 * 10);
+
+    for (auto [name, transport] :
+         {std::pair{"oink_test_mq", oink::transport_kind::message_queue},
+          std::pair{"oink_test_spsc", oink::transport_kind::spsc_ring},
+          std::pair{"oink_test_mpsc", oink::transport_kind::mpsc_ring},
+          std::pair{"oink_test_mpmc", oink::transport_kind::mpmc_ring}}) {
+      oink::sender endpoint(arena, name, 64, {.transport = transport});
+      oink::receiver rendpoint(arena, name, 64, {.transport = transport});
+
+      endpoint.send_batch<mymsg>(std::views::iota(0, 10));
+
+      std::vector<int> values;
+      auto visitor = overloaded{[&](mymsg &msg) { values.push_back(msg.i); }};
+      CHECK(rendpoint.receive_many<mymsg>(visitor, 4) == 4);
+      CHECK(rendpoint.receive_many<mymsg>(visitor, 100) == 6);
+      CHECK(values == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+      CHECK(rendpoint.get_wait_stats().immediate == 2);
+
+      // Rejected messages are put back
+      endpoint.send_batch<mymsg>(std::views::iota(0, 4));
+      CHECK(rendpoint.receive_many<mymsg>(overloaded{[&](mymsg &msg) { return msg.i % 2 == 0; }},
+                                          4) == 2);
+      values.clear();
+      CHECK(rendpoint.receive_many<mymsg>(visitor, 4) == 2);
+      CHECK(values == std::vector<int>{1, 3});
+    }
+  }
+
+  TEST_CASE("priorities") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    struct stop {
+      static constexpr const char *name() { return "stop"; }
+    };
+
+    oink::arena arena("oink_test", 65536 * 10);
+
+    for (auto [name, transport] :
+         {std::pair{"oink_test_mq", oink::transport_kind::message_queue},
+          std::pair{"oink_test_mpsc", oink::transport_kind::mpsc_ring}}) {
+      oink::endpoint_options options{.transport = transport, .priorities = 2};
+      oink::sender endpoint(arena, name, 64, options);
+      oink::receiver rendpoint(arena, name, 64, options);
+
+      endpoint.send_batch<mymsg>(std::views::iota(0, 10));
+      endpoint.send<stop>(oink::priority{1});
+
+      std::optional<unsigned int> stop_priority;
+      int received = 0;
+      auto visitor = overloaded{[&](mymsg &) { received++; },
+                                [&](stop &, oink::priority p) { stop_priority = p.value; }};
+      CHECK(rendpoint.receive<mymsg, stop>(visitor));
+      // Control message jumped ahead of the bulk data
+      CHECK(received == 0);
+      CHECK(stop_priority == 1u);
+
+      std::optional<unsigned int> msg_priority;
+      CHECK(rendpoint.receive_many<mymsg>(
+                overloaded{[&](mymsg &, oink::priority p) { msg_priority = p.value; }}, 10) == 10);
+      CHECK(msg_priority == 0u);
+    }
+  }
+
+  TEST_CASE("deadlines and polling") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    for (auto [name, transport] :
+         {std::pair{"oink_test_mq", oink::transport_kind::message_queue},
+          std::pair{"oink_test_spsc", oink::transport_kind::spsc_ring}}) {
+      oink::sender endpoint(arena, name, 16, {.transport = transport});
+      oink::receiver rendpoint(arena, name, 16, {.transport = transport});
+
+      int received = 0;
+      auto visitor = overloaded{[&](mymsg &msg) { received = msg.i; }};
+
+      CHECK(!rendpoint.try_receive<mymsg>(visitor));
+      endpoint.send<mymsg>(1);
+      CHECK(rendpoint.try_receive<mymsg>(visitor));
+      CHECK(received == 1);
+      CHECK(!rendpoint.try_receive<mymsg>(visitor));
+
+      auto start = std::chrono::steady_clock::now();
+      CHECK(!rendpoint.receive_for<mymsg>(visitor, std::chrono::milliseconds(20)));
+      auto waited = std::chrono::steady_clock::now() - start;
+      CHECK(waited >= std::chrono::milliseconds(20));
+      CHECK(waited < std::chrono::milliseconds(400));
+
+      CHECK(!rendpoint.receive_until<mymsg>(visitor, std::chrono::steady_clock::now()));
+
+      std::thread st([&]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        endpoint.send<mymsg>(2);
+      });
+      CHECK(rendpoint.receive_until<mymsg>(visitor, oink::receiver::clock::time_point::max()));
+      st.join();
+      CHECK(received == 2);
+    }
+  }
+
+  TEST_CASE("per-type queues") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct msg_a {
+      static constexpr const char *name() { return "a"; }
+      int i;
+    };
+    struct msg_b {
+      static constexpr const char *name() { return "b"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::endpoint_options options{.transport = oink::transport_kind::mpmc_ring,
+                                   .per_type_queues = true};
+    oink::sender endpoint(arena, "oink_test_typed", 16, options);
+    oink::receiver rendpoint(arena, "oink_test_typed", 16, options);
+
+    CHECK_THROWS_AS(oink::receiver(arena, "oink_test_typed", 16,
+                                   {.transport = oink::transport_kind::mpmc_ring}),
+                    std::invalid_argument);
+
+    for (int i = 0; i < 3; i++) {
+      endpoint.send<msg_b>(i);
+    }
+    endpoint.send<msg_a>(10);
+
+    // Only the queue of `msg_a` is looked at, so no `msg_b` gets dequeued and deferred
+    std::vector<int> as;
+    auto on_a = overloaded{[&](msg_a &msg) { as.push_back(msg.i); }};
+    CHECK(rendpoint.receive_many<msg_a>(on_a, 16) == 1);
+    CHECK(as == std::vector<int>{10});
+    CHECK(!rendpoint.try_receive<msg_a>(on_a));
+    CHECK(rendpoint.deferred() == 0);
+
+    // Waiting for `msg_a` is woken up by it alone
+    std::thread st([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      endpoint.send<msg_a>(11);
+    });
+    CHECK(rendpoint.receive_for<msg_a>(on_a, std::chrono::seconds(5)));
+    st.join();
+    CHECK(as == std::vector<int>{10, 11});
+
+    // Receiving everything goes through all the queues
+    std::vector<int> bs;
+    auto on_any = overloaded{[&](msg_a &msg) { as.push_back(msg.i); },
+                             [&](msg_b &msg) { bs.push_back(msg.i); }};
+    endpoint.send<msg_a>(12);
+    CHECK(rendpoint.receive_many<msg_a, msg_b>(on_any, 16) == 4);
+    CHECK(bs == std::vector<int>{0, 1, 2});
+    CHECK(as == std::vector<int>{10, 11, 12});
+
+    // Deferred messages of other types are left alone too
+    endpoint.send<msg_a>(13);
+    CHECK(!rendpoint.receive<msg_a>(overloaded{[&](msg_a &) { return false; }}));
+    CHECK(rendpoint.deferred() == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    endpoint.send<msg_b>(3);
+    auto on_b = overloaded{[&](msg_b &msg) { bs.push_back(msg.i); }};
+    CHECK(rendpoint.receive_for<msg_b>(on_b, std::chrono::seconds(5)));
+    CHECK_NOTHROW(CHECK(!rendpoint.try_receive<msg_b>(on_b)));
+    CHECK(!rendpoint.receive_for<msg_b>(on_b, std::chrono::milliseconds(5)));
+    CHECK(bs == std::vector<int>{0, 1, 2, 3});
+    CHECK(rendpoint.deferred() == 1);
+    CHECK(rendpoint.receive_for<msg_a>(on_a, std::chrono::seconds(5)));
+    CHECK(as == std::vector<int>{10, 11, 12, 13});
+    CHECK(rendpoint.deferred() == 0);
+
+    // Per-type queues of message queue endpoints are kept in the arena, leaving nothing else
+    // behind in shared memory
+    oink::endpoint_options mq_options{.per_type_queues = true};
+    oink::sender mq_endpoint(arena, "oink_test_typed_mq", 16, mq_options);
+    oink::receiver mq_rendpoint(arena, "oink_test_typed_mq", 16, mq_options);
+    mq_endpoint.send<msg_b>(4);
+    mq_endpoint.send<msg_a>(14);
+    CHECK(mq_rendpoint.receive_many<msg_a>(on_a, 16) == 1);
+    CHECK(mq_rendpoint.receive_many<msg_b>(on_b, 16) == 1);
+    CHECK(as.back() == 14);
+    CHECK(bs.back() == 4);
+    for (auto hash : {oink::message_tag<msg_a>(), oink::message_tag<msg_b>()}) {
+      auto name = "oink_test_typed_mq." + std::to_string(hash);
+      CHECK_THROWS(oink::bip::message_queue(oink::bip::open_only, name.c_str()));
+      // In case a build that still created them left them behind
+      oink::bip::message_queue::remove(name.c_str());
+    }
+  }
+
+  TEST_CASE("pollable handle") {
+    oink::bip::shared_memory_object::remove("oink_test");
     oink::bip::remove_shared_memory_on_destroy _test("oink_test");
-    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
 
     struct mymsg {
       static constexpr const char *name() { return "msg"; }
       int i;
     };
 
-    struct mymsg1 {
-      static constexpr const char *name() { return "msg1"; }
-      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+    oink::arena arena("oink_test", 65536);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpsc_ring};
+    oink::sender endpoint(arena, "oink_test_poll", 16, options);
+    oink::receiver rendpoint(arena, "oink_test_poll", 16, options);
+
+    // A message that is already there makes the handle readable right away
+    endpoint.send<mymsg>(0);
+    pollfd fd{.fd = rendpoint.native_handle(), .events = POLLIN, .revents = 0};
+    CHECK(poll(&fd, 1, 0) == 1);
+
+    std::vector<int> received;
+    auto visitor = overloaded{[&](mymsg &msg) { received.push_back(msg.i); }};
+    while (rendpoint.try_receive<mymsg>(visitor)) {
+    }
+    CHECK(poll(&fd, 1, 0) == 0);
 
-      mymsg1(const char *msg, const oink::allocator<char> &alloc) : message(msg, alloc) {}
+    std::thread st([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      for (int i = 1; i <= 3; i++) {
+        endpoint.send<mymsg>(i);
+      }
+    });
+    CHECK(poll(&fd, 1, 5000) == 1);
+    st.join();
+    while (rendpoint.try_receive<mymsg>(visitor)) {
+    }
+    CHECK(received == std::vector<int>{0, 1, 2, 3});
+    CHECK(poll(&fd, 1, 0) == 0);
+  }
+
+  TEST_CASE("pollable handle across processes") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
     };
 
     oink::arena arena("oink_test", 65536);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpsc_ring};
+    oink::sender endpoint(arena, "oink_test_poll", 16, options);
+
+    // A receiver in another process is woken up through its handle
+    int ready[2];
+    REQUIRE(pipe(ready) == 0);
+    auto child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+      int status = 1;
+      {
+        oink::arena arena("oink_test");
+        oink::receiver rendpoint(arena, "oink_test_poll", 16, options);
+        pollfd fd{.fd = rendpoint.native_handle(), .events = POLLIN, .revents = 0};
+        char c = 0;
+        [[maybe_unused]] auto written = write(ready[1], &c, 1);
+        int received = 0;
+        auto visitor = overloaded{[&](mymsg &msg) { received = msg.i; }};
+        if (poll(&fd, 1, 5000) == 1 && rendpoint.try_receive<mymsg>(visitor) && received == 1) {
+          status = 0;
+        }
+      }
+      _exit(status);
+    }
+    char c;
+    REQUIRE(read(ready[0], &c, 1) == 1);
+    endpoint.send<mymsg>(1);
+    int status = -1;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status));
+    CHECK(WEXITSTATUS(status) == 0);
+
+    // Processes that die without removing their handles don't keep the slots, whether
+    // they're armed or not
+    auto remove_handles = [](pid_t pid) {
+      auto prefix = "oink-" + std::to_string(pid) + "-";
+      auto dir = std::filesystem::temp_directory_path();
+      for (auto &entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().filename().string().starts_with(prefix)) {
+          std::filesystem::remove(entry.path());
+        }
+      }
+    };
+    child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+      oink::arena arena("oink_test");
+      auto rendpoint = new oink::receiver(arena, "oink_test_poll", 16, options);
+      rendpoint->native_handle();
+      _exit(0);
+    }
+    REQUIRE(waitpid(child, &status, 0) == child);
+    remove_handles(child);
+    endpoint.send<mymsg>(2);
+    // This one finds a message pending, so its handle is signalled right away and disarmed
+    child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+      oink::arena arena("oink_test");
+      auto rendpoint = new oink::receiver(arena, "oink_test_poll", 16, options);
+      rendpoint->native_handle();
+      _exit(0);
+    }
+    REQUIRE(waitpid(child, &status, 0) == child);
+    remove_handles(child);
+    std::vector<std::unique_ptr<oink::receiver>> receivers;
+    for (std::size_t i = 0; i < oink::poll_list::max_pollers; i++) {
+      receivers.push_back(std::make_unique<oink::receiver>(arena, "oink_test_poll", 16, options));
+      CHECK_NOTHROW(receivers.back()->native_handle());
+    }
+    close(ready[0]);
+    close(ready[1]);
+  }
 
-    oink::sender endpoint(arena, "oink_test_mq", 1024);
-    endpoint.send<mymsg1>("allocator", endpoint.get_allocator<char>());
+  TEST_CASE("pollable handle that can't be signalled") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
 
-    oink::receiver rendpoint(arena, "oink_test_mq", 1024);
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
 
-    CHECK_THROWS_WITH_AS(
-        rendpoint.receive<mymsg>(overloaded{[&](mymsg &) {}}),
-        (std::string("unknown message ") + std::to_string(oink::message_tag<mymsg1>())).c_str(),
-        oink::receiver::unknown_message);
+    oink::arena arena("oink_test", 65536);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpsc_ring};
+    oink::sender endpoint(arena, "oink_test_poll", 16, options);
+    oink::receiver rendpoint(arena, "oink_test_poll", 16, options);
+
+    sockaddr_un address{};
+    socklen_t length = sizeof(address);
+    REQUIRE(getsockname(rendpoint.native_handle(), reinterpret_cast<sockaddr *>(&address),
+                        &length) == 0);
+    // Something that isn't a datagram socket takes the handle's path over
+    REQUIRE(unlink(address.sun_path) == 0);
+    oink::file_descriptor stream(socket(AF_UNIX, SOCK_STREAM, 0));
+    REQUIRE(bind(stream.get(), reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+
+    // The message is sent all the same
+    CHECK(!endpoint.signal_error());
+    CHECK_NOTHROW(endpoint.send<mymsg>(1));
+    CHECK(endpoint.signal_error());
+    int received = 0;
+    CHECK(rendpoint.try_receive<mymsg>(overloaded{[&](mymsg &msg) { received = msg.i; }}));
+    CHECK(received == 1);
   }
 
-  TEST_CASE("catch all") {
+  TEST_CASE("event handle paths in use") {
+    std::string path;
+    {
+      oink::event_handle handle;
+      path = handle.path().data();
+    }
+    // The path the next handle would get is bound by somebody else, such as a process with
+    // the same pid in another pid namespace
+    auto dash = path.rfind('-');
+    auto next = path.substr(0, dash + 1) + std::to_string(std::stoull(path.substr(dash + 1)) + 1);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::ranges::copy(next, address.sun_path);
+    oink::file_descriptor taken(socket(AF_UNIX, SOCK_DGRAM, 0));
+    REQUIRE(bind(taken.get(), reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+
+    oink::event_handle handle;
+    CHECK(std::string(handle.path().data()) != next);
+    oink::event_handle::path_type taken_path{};
+    std::ranges::copy(next, taken_path.begin());
+    CHECK(oink::event_handle::alive(taken_path));
+    unlink(next.c_str());
+  }
+
+  TEST_CASE("expiry") {
     oink::bip::shared_memory_object::remove("oink_test");
-    oink::bip::shared_memory_object::remove("oink_test_mq");
     oink::bip::remove_shared_memory_on_destroy _test("oink_test");
-    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
 
+    static int destroyed = 0;
     struct mymsg {
       static constexpr const char *name() { return "msg"; }
+      explicit mymsg(int i) : i(i) {}
+      ~mymsg() { destroyed++; }
       int i;
     };
 
-    struct mymsg1 {
-      static constexpr const char *name() { return "msg1"; }
-      oink::bc::basic_string<char, std::char_traits<char>, oink::allocator<char>> message;
+    oink::arena arena("oink_test", 65536);
+    oink::endpoint_options options{.transport = oink::transport_kind::spsc_ring};
+    oink::sender endpoint(arena, "oink_test_ttl", 16, options);
+    oink::receiver rendpoint(arena, "oink_test_ttl", 16, options);
+    auto free_memory = arena.get_free_memory();
+
+    auto expired = oink::expiry::after(-std::chrono::milliseconds(1));
+    auto later = oink::expiry::after(std::chrono::seconds(60));
+    endpoint.send<mymsg>(expired, 1);
+    endpoint.send<mymsg>(oink::priority{}, later, 2);
+    endpoint.send<mymsg>(oink::priority{1}, expired, 3);
+    endpoint.send<mymsg>(4);
+
+    std::vector<int> received;
+    auto visitor = overloaded{[&](mymsg &msg) { received.push_back(msg.i); }};
+    CHECK(rendpoint.receive_many<mymsg>(visitor, 16) == 2);
+    CHECK(received == std::vector<int>{2, 4});
+    CHECK(rendpoint.get_wait_stats().expired == 2);
+    CHECK(destroyed == 4);
+    CHECK(arena.get_free_memory() == free_memory);
+
+    // Single receives skip expired messages and go on to the next one
+    endpoint.send<mymsg>(expired, 5);
+    endpoint.send<mymsg>(6);
+    CHECK(rendpoint.receive<mymsg>(visitor));
+    CHECK(received.back() == 6);
+    endpoint.send<mymsg>(expired, 7);
+    CHECK(!rendpoint.try_receive<mymsg>(visitor));
+    CHECK(rendpoint.get_wait_stats().expired == 4);
+  }
 
-      mymsg1(const char *msg, const oink::allocator<char> &alloc) : message(msg, alloc) {}
+  TEST_CASE("scheduled delivery") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      explicit mymsg(int i) : i(i) {}
+      int i;
     };
 
-    oink::arena arena("oink_test", 65536);
+    oink::arena arena("oink_test", 1024 * 1024);
+    oink::endpoint_options options{.transport = oink::transport_kind::mpsc_ring};
+    oink::sender endpoint(arena, "oink_test_timers", 1024, options);
+    oink::receiver rendpoint(arena, "oink_test_timers", 1024, options);
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    endpoint.send_after<mymsg>(std::chrono::milliseconds(30), 1);
+    std::vector<int> received;
+    auto visitor = overloaded{[&](mymsg &msg) { received.push_back(msg.i); }};
+    CHECK(!rendpoint.try_receive<mymsg>(visitor));
+    CHECK(rendpoint.receive_for<mymsg>(visitor, std::chrono::seconds(5)));
+    CHECK(clock::now() - start >= std::chrono::milliseconds(30));
+    CHECK(received == std::vector<int>{1});
+    // The first scheduled message created the endpoint's timer wheel
+    auto free_memory = arena.get_free_memory();
+
+    // Timers scheduled out of order come out in due order, including ones far enough out
+    // to sit in the upper levels of the wheel
+    received.clear();
+    start = clock::now();
+    std::vector<int> expected;
+    for (int i = 0; i < 200; i++) {
+      int delay = (i * 37) % 200;
+      // Entries due by the time they're scheduled would share the next tick, where they come
+      // out in no particular order
+      endpoint.send_at<mymsg>(start + std::chrono::milliseconds(10 + delay), delay);
+      expected.push_back(delay);
+    }
+    std::ranges::sort(expected);
+    while (received.size() < expected.size() &&
+           rendpoint.receive_for<mymsg>(visitor, std::chrono::seconds(5))) {
+    }
+    CHECK(received == expected);
+
+    // A wakeup for an earlier timer doesn't count as a message
+    endpoint.send_after<mymsg>(std::chrono::milliseconds(5), 2);
+    endpoint.send_at<mymsg>(start - std::chrono::seconds(1), 3);
+    CHECK(rendpoint.receive_for<mymsg>(visitor, std::chrono::seconds(5)));
+    CHECK(received.back() == 3);
+    CHECK(rendpoint.receive_for<mymsg>(visitor, std::chrono::seconds(5)));
+    CHECK(received.back() == 2);
+    CHECK(arena.get_free_memory() == free_memory);
+
+    // Scheduled messages take no room in the queue, and are due by `next_wake()`
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+    oink::sender mq_endpoint(arena, "oink_test_mq", 1);
+    oink::receiver mq_rendpoint(arena, "oink_test_mq", 1);
+    CHECK(mq_rendpoint.next_wake() == clock::time_point::max());
+    mq_endpoint.send_after<mymsg>(std::chrono::milliseconds(20), 4);
+    CHECK(mq_endpoint.try_send<mymsg>(5));
+    // Timer ticks are a millisecond long
+    CHECK(mq_rendpoint.next_wake() <= clock::now() + std::chrono::milliseconds(22));
+    received.clear();
+    CHECK(mq_rendpoint.try_receive<mymsg>(visitor));
+    CHECK(!mq_rendpoint.try_receive<mymsg>(visitor));
+    std::this_thread::sleep_until(mq_rendpoint.next_wake());
+    CHECK(mq_rendpoint.try_receive<mymsg>(visitor));
+    CHECK(received == std::vector<int>{5, 4});
+  }
 
-    oink::sender endpoint(arena, "oink_test_mq", 1024);
-    endpoint.send<mymsg1>("allocator", endpoint.get_allocator<char>());
+  TEST_CASE("timer wakeups") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
 
-    oink::receiver rendpoint(arena, "oink_test_mq", 1024);
+    using clock = std::chrono::steady_clock;
+    using std::chrono::milliseconds;
 
-    std::optional<std::size_t> received_hash = std::nullopt;
-    rendpoint.receive(overloaded{[&](oink::receiver::msg &msg) { received_hash = msg.hash; }});
-    CHECK(received_hash.has_value());
-    CHECK(received_hash.value() == oink::message_tag<mymsg1>());
+    oink::arena arena("oink_test", 65536);
+    auto &wheel = *arena.get_segment_manager()->construct<oink::timer_wheel<int>>(
+        oink::bip::anonymous_instance)(arena.get_segment_manager());
+    auto now = clock::now();
+
+    // Waiters from before the wheel existed may be parked for however long
+    CHECK(wheel.schedule(1, now + milliseconds(1000)));
+    // They're all woken up then, and don't park again without saying until when
+    CHECK(!wheel.schedule(2, now + milliseconds(900)));
+
+    // A parked waiter is only woken up for entries due before it would wake up anyway, and
+    // just once for a run of them
+    CHECK(wheel.park_until() == wheel.next_due());
+    CHECK(!wheel.schedule(3, now + milliseconds(950)));
+    std::vector<bool> wakes;
+    for (int i = 0; i < 10; i++) {
+      wakes.push_back(wheel.schedule(4 + i, now + milliseconds(800 - i * 10)));
+    }
+    CHECK(std::ranges::count(wakes, true) == 1);
+    CHECK(wakes.front());
+
+    std::vector<int> due;
+    wheel.advance(now + milliseconds(2000), [&](int i) {
+      due.push_back(i);
+      return true;
+    });
+    CHECK(due == std::vector<int>{13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 2, 3, 1});
+    arena.get_segment_manager()->destroy_ptr(&wheel);
+
+    // Receivers parked until a later message still get an earlier one in time
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+    oink::endpoint_options options{.transport = oink::transport_kind::mpsc_ring};
+    oink::sender endpoint(arena, "oink_test_timers", 16, options);
+    oink::receiver rendpoint(arena, "oink_test_timers", 16, options);
+    endpoint.send_after<mymsg>(std::chrono::seconds(3), 1);
+    std::vector<int> received;
+    std::thread st([&]() {
+      std::this_thread::sleep_for(milliseconds(20));
+      endpoint.send_after<mymsg>(milliseconds(10), 2);
+    });
+    auto start = clock::now();
+    CHECK(rendpoint.receive_for<mymsg>(overloaded{[&](mymsg &msg) { received.push_back(msg.i); }},
+                                       std::chrono::seconds(5)));
+    CHECK(clock::now() - start < std::chrono::seconds(2));
+    st.join();
+    CHECK(received == std::vector<int>{2});
   }
 
   TEST_CASE("rescheduling") {
@@ -261,6 +2027,80 @@ TEST_SUITE("receiver") {
     CHECK(!rendpoint.receive<mymsg>(overloaded{[&](mymsg &) {}}));
   }
 
+  TEST_CASE("deferred retries") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::shared_memory_object::remove("oink_test_mq");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test_mq("oink_test_mq");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::endpoint_options options{.retry = {.initial_delay = std::chrono::milliseconds(10),
+                                             .max_delay = std::chrono::milliseconds(20)}};
+    oink::sender endpoint(arena, "oink_test_mq", 16, options);
+
+    {
+      oink::receiver rendpoint(arena, "oink_test_mq", 16, options);
+
+      endpoint.send<mymsg>(1);
+      CHECK(!rendpoint.receive<mymsg>(overloaded{[&](mymsg &) { return false; }}));
+      CHECK(rendpoint.deferred() == 1);
+      endpoint.send<mymsg>(2);
+
+      // Not due yet, so the queue goes first
+      std::vector<int> values;
+      auto collect = overloaded{[&](mymsg &msg) { values.push_back(msg.i); }};
+      CHECK(rendpoint.try_receive<mymsg>(collect));
+      CHECK(values == std::vector<int>{2});
+
+      // Waiting for the queue wakes up for the retry
+      auto start = std::chrono::steady_clock::now();
+      CHECK(!rendpoint.receive<mymsg>(overloaded{[&](mymsg &) { return false; }}));
+      CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(400));
+
+      // Backs off further on the second rejection
+      CHECK(!rendpoint.try_receive<mymsg>(collect));
+      start = std::chrono::steady_clock::now();
+      CHECK(rendpoint.receive<mymsg>(collect));
+      CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+      CHECK(values == std::vector<int>{2, 1});
+      CHECK(rendpoint.deferred() == 0);
+
+      endpoint.send<mymsg>(3);
+      CHECK(!rendpoint.receive<mymsg>(overloaded{[&](mymsg &) { return false; }}));
+    }
+
+    // Destroyed receiver hands its deferred messages back to the queue
+    oink::receiver rendpoint(arena, "oink_test_mq", 16, options);
+    int received = 0;
+    CHECK(rendpoint.try_receive<mymsg>(overloaded{[&](mymsg &msg) { received = msg.i; }}));
+    CHECK(received == 3);
+
+    // Deferred messages that don't fit back into a full queue are released
+    auto free_memory = arena.get_free_memory();
+    {
+      oink::receiver deferring(arena, "oink_test_mq", 16, options);
+      for (int i = 0; i < 16; i++) {
+        endpoint.send<mymsg>(i);
+      }
+      CHECK(deferring.receive_many<mymsg>(overloaded{[&](mymsg &) { return false; }}, 4) == 0);
+      CHECK(deferring.deferred() == 4);
+      for (int i = 0; i < 4; i++) {
+        endpoint.send<mymsg>(16 + i);
+      }
+    }
+    std::vector<int> values;
+    while (rendpoint.try_receive<mymsg>(overloaded{[&](mymsg &msg) { values.push_back(msg.i); }})) {
+    }
+    CHECK(values.size() == 16);
+    CHECK(arena.get_free_memory() == free_memory);
+  }
+
   TEST_CASE("rescheduling catch-all") {
     oink::bip::shared_memory_object::remove("oink_test");
     oink::bip::shared_memory_object::remove("oink_test_mq");
@@ -344,3 +2184,333 @@ TEST_CASE("message receipt copying") {
   oink::message_envelope_receipt<mymsg> receipt2 = endpoint.send<mymsg>(321);
   receipt1 = receipt2;
 }
+
+TEST_SUITE("transports") {
+  TEST_CASE("spsc ring") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 4,
+                          {.transport = oink::transport_kind::spsc_ring});
+    oink::receiver rendpoint(arena, "oink_test_mq", 4,
+                             {.transport = oink::transport_kind::spsc_ring});
+
+    endpoint.send<mymsg>(1);
+    endpoint.send<mymsg>(2);
+
+    std::vector<int> values;
+    CHECK(rendpoint.receive<mymsg>(overloaded{[&](mymsg &msg) { values.push_back(msg.i); }}));
+    CHECK(rendpoint.receive<mymsg>(overloaded{[&](mymsg &msg) { values.push_back(msg.i); }}));
+    CHECK(values == std::vector<int>{1, 2});
+    CHECK(!rendpoint.receive<mymsg>(overloaded{[&](mymsg &) {}}));
+  }
+
+  TEST_CASE("spsc ring (multithreading)") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    struct stop {
+      static constexpr const char *name() { return "stop"; }
+    };
+
+    oink::arena arena("oink_test", 65536 * 100);
+
+    // A small ring makes the producer wrap around and wait for the consumer
+    oink::sender endpoint(arena, "oink_test_mq", 8, {.transport = oink::transport_kind::spsc_ring});
+
+    std::vector<int> values;
+    std::thread rt([&]() {
+      oink::receiver rendpoint(arena, "oink_test_mq", 8,
+                               {.transport = oink::transport_kind::spsc_ring});
+      bool done = false;
+      while (!done) {
+        rendpoint.receive<mymsg, stop>(
+            overloaded{[&](mymsg &msg) { values.push_back(msg.i); }, [&](stop &) { done = true; }});
+      }
+    });
+
+    for (int i = 0; i < 1000; i++) {
+      endpoint.send<mymsg>(i);
+    }
+    endpoint.send<stop>();
+
+    rt.join();
+    // Single producer, single consumer: order is preserved
+    CHECK(values.size() == 1000);
+    for (int i = 0; auto &v : values) {
+      CHECK(v == i);
+      i++;
+    }
+  }
+
+  TEST_CASE("mpsc ring (multithreading)") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int producer;
+      int i;
+    };
+
+    struct stop {
+      static constexpr const char *name() { return "stop"; }
+    };
+
+    oink::arena arena("oink_test", 65536 * 100);
+
+    std::vector<std::vector<int>> values(8);
+    std::thread rt([&]() {
+      oink::receiver rendpoint(arena, "oink_test_mq", 16,
+                               {.transport = oink::transport_kind::mpsc_ring});
+      bool done = false;
+      while (!done) {
+        rendpoint.receive<mymsg, stop>(
+            overloaded{[&](mymsg &msg) { values[msg.producer].push_back(msg.i); },
+                       [&](stop &) { done = true; }});
+      }
+    });
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < 8; p++) {
+      threads.emplace_back(
+          [&](int producer) {
+            oink::sender endpoint(arena, "oink_test_mq", 16,
+                                  {.transport = oink::transport_kind::mpsc_ring});
+            for (int i = 0; i < 500; i++) {
+              endpoint.send<mymsg>(producer, i);
+            }
+          },
+          p);
+    }
+
+    for (auto &t : threads) {
+      t.join();
+    }
+    oink::sender(arena, "oink_test_mq", 16, {.transport = oink::transport_kind::mpsc_ring})
+        .send<stop>();
+
+    rt.join();
+    // Every producer's messages arrive, in the order that producer sent them
+    for (auto &producer_values : values) {
+      CHECK(producer_values.size() == 500);
+      for (int i = 0; auto &v : producer_values) {
+        CHECK(v == i);
+        i++;
+      }
+    }
+  }
+
+  TEST_CASE("mpsc ring of one message") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 1,
+                          {.transport = oink::transport_kind::mpsc_ring});
+    oink::receiver rendpoint(arena, "oink_test_mq", 1,
+                             {.transport = oink::transport_kind::mpsc_ring});
+
+    // Queued messages don't overwrite each other
+    CHECK(endpoint.try_send<mymsg>(1).status == oink::send_status::queued);
+    CHECK(endpoint.try_send<mymsg>(2).status == oink::send_status::queued);
+    std::vector<int> values;
+    auto visitor = overloaded{[&](mymsg &msg) { values.push_back(msg.i); }};
+    CHECK(rendpoint.try_receive<mymsg>(visitor));
+    CHECK(rendpoint.try_receive<mymsg>(visitor));
+    CHECK(!rendpoint.try_receive<mymsg>(visitor));
+    CHECK(values == std::vector<int>{1, 2});
+  }
+
+  TEST_CASE("mpmc ring (multithreading)") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    struct stop {
+      static constexpr const char *name() { return "stop"; }
+    };
+
+    oink::arena arena("oink_test", 65536 * 100);
+
+    std::mutex values_mutex;
+    std::vector<int> values;
+    std::vector<std::thread> receivers;
+    for (int r = 0; r < 4; r++) {
+      receivers.emplace_back([&]() {
+        oink::receiver rendpoint(arena, "oink_test_mq", 16,
+                                 {.transport = oink::transport_kind::mpmc_ring});
+        bool done = false;
+        auto collect = [&](mymsg &msg) {
+          std::scoped_lock lock(values_mutex);
+          values.push_back(msg.i);
+        };
+        while (!done) {
+          rendpoint.receive<mymsg, stop>(overloaded{collect, [&](stop &) { done = true; }});
+        }
+      });
+    }
+
+    std::vector<std::thread> senders;
+    for (int p = 0; p < 4; p++) {
+      senders.emplace_back(
+          [&](int producer) {
+            oink::sender endpoint(arena, "oink_test_mq", 16,
+                                  {.transport = oink::transport_kind::mpmc_ring});
+            for (int i = 0; i < 250; i++) {
+              endpoint.send<mymsg>(producer * 250 + i);
+            }
+          },
+          p);
+    }
+
+    for (auto &t : senders) {
+      t.join();
+    }
+    oink::sender endpoint(arena, "oink_test_mq", 16,
+                          {.transport = oink::transport_kind::mpmc_ring});
+    for (std::size_t r = 0; r < receivers.size(); r++) {
+      endpoint.send<stop>();
+    }
+    for (auto &t : receivers) {
+      t.join();
+    }
+
+    CHECK(values.size() == 1000);
+    std::sort(values.begin(), values.end());
+    for (int i = 0; auto &v : values) {
+      CHECK(v == i);
+      i++;
+    }
+  }
+
+  TEST_CASE("mpmc ring of one message") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 1,
+                          {.transport = oink::transport_kind::mpmc_ring});
+    oink::receiver rendpoint1(arena, "oink_test_mq", 1,
+                              {.transport = oink::transport_kind::mpmc_ring});
+    oink::receiver rendpoint2(arena, "oink_test_mq", 1,
+                              {.transport = oink::transport_kind::mpmc_ring});
+
+    std::vector<int> values;
+    auto visitor = overloaded{[&](mymsg &msg) { values.push_back(msg.i); }};
+    // An empty ring reads as empty rather than as a message being published
+    CHECK(!rendpoint1.try_receive<mymsg>(visitor));
+    for (int i = 0; i < 4; i++) {
+      CHECK(endpoint.try_send<mymsg>(i).status == oink::send_status::queued);
+      CHECK((i % 2 == 0 ? rendpoint1 : rendpoint2).try_receive<mymsg>(visitor));
+      CHECK(!rendpoint1.try_receive<mymsg>(visitor));
+    }
+    CHECK(values == std::vector<int>{0, 1, 2, 3});
+  }
+
+  TEST_CASE("mpmc ring rescheduling") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 16,
+                          {.transport = oink::transport_kind::mpmc_ring});
+    oink::receiver rendpoint1(arena, "oink_test_mq", 16,
+                              {.transport = oink::transport_kind::mpmc_ring});
+    oink::receiver rendpoint2(arena, "oink_test_mq", 16,
+                              {.transport = oink::transport_kind::mpmc_ring});
+
+    endpoint.send<mymsg>(10);
+
+    // A declined message stays with the receiver that declined it
+    CHECK(!rendpoint1.receive<mymsg>(overloaded{[&](mymsg &) { return false; }}));
+    CHECK(!rendpoint2.try_receive<mymsg>(overloaded{[&](mymsg &) {}}));
+    int received = 0;
+    CHECK(rendpoint1.receive<mymsg>(overloaded{[&](mymsg &msg) {
+      received = msg.i;
+      return true;
+    }}));
+    CHECK(received == 10);
+    CHECK(!rendpoint1.try_receive<mymsg>(overloaded{[&](mymsg &) {}}));
+  }
+
+  TEST_CASE("transport mismatch") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 16,
+                          {.transport = oink::transport_kind::spsc_ring});
+    CHECK_THROWS_AS(oink::receiver(arena, "oink_test_mq", 16,
+                                   {.transport = oink::transport_kind::mpsc_ring}),
+                    std::invalid_argument);
+  }
+
+  TEST_CASE("ring receiver wakes up on send") {
+    oink::bip::shared_memory_object::remove("oink_test");
+    oink::bip::remove_shared_memory_on_destroy _test("oink_test");
+
+    struct mymsg {
+      static constexpr const char *name() { return "msg"; }
+      int i;
+    };
+
+    oink::arena arena("oink_test", 65536);
+
+    oink::sender endpoint(arena, "oink_test_mq", 16,
+                          {.transport = oink::transport_kind::mpsc_ring});
+
+    int received = 0;
+    std::chrono::steady_clock::duration waited{};
+    std::thread rt([&]() {
+      oink::receiver rendpoint(arena, "oink_test_mq", 16,
+                               {.transport = oink::transport_kind::mpsc_ring});
+      auto start = std::chrono::steady_clock::now();
+      CHECK(rendpoint.receive<mymsg>(overloaded{[&](mymsg &msg) { received = msg.i; }}));
+      waited = std::chrono::steady_clock::now() - start;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    endpoint.send<mymsg>(1);
+    rt.join();
+
+    CHECK(received == 1);
+    // Parked receiver is woken up by the send rather than by the receive timeout
+    CHECK(waited < std::chrono::milliseconds(400));
+  }
+}